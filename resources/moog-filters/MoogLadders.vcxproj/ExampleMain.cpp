@@ -4,6 +4,8 @@
 
 #include "AudioDevice.h"
 #include "NoiseGenerator.h"
+#include "MixingRingBuffer.h"
+#include "SampleRateConverter.h"
 
 #include "StilsonModel.h"
 #include "OberheimVariationModel.h"
@@ -15,10 +17,271 @@
 #include "MicrotrackerModel.h"
 #include "MusicDSPModel.h"
 #include "RKSimulationModel.h"
+#include "FixedPointModels.h"
 
 #include <thread>
 #include <chrono>
 #include <vector>
+#include <atomic>
+#include <algorithm>
+
+// Runs a Huovilainen insert on both channels of a stereo duplex stream at each
+// buffer size and prints the driver-reported xrun rate
+void XrunSweep(int sampleRate, double secondsPerSize)
+{
+	const unsigned int sizes[] = { 16, 32, 64, 128, 256, 512 };
+
+	for (unsigned int size : sizes)
+	{
+		// On the stack, the models are over-aligned for their SIMD buffers
+		HuovilainenMoog left(sampleRate);
+		HuovilainenMoog right(sampleRate);
+		std::vector<FilterChain> chains = { { &left }, { &right } };
+
+		AudioDevice device(2, sampleRate, -1, size);
+		device.OpenDuplex(-1, chains);
+		std::this_thread::sleep_for(std::chrono::duration<double>(secondsPerSize));
+
+		const StreamStats stats = device.GetStreamStats();
+		std::cout << "[xrun] requested " << size << " negotiated " << device.info.frameSize
+			<< ": " << stats.xruns << " / " << stats.callbacks << " callbacks ("
+			<< (stats.callbacks ? 100.0 * stats.xruns / stats.callbacks : 0.0) << "%)" << std::endl;
+	}
+}
+
+// Producer threads render voices into a MixingRingBuffer while a consumer
+// paced like a 64-frame callback mixes them. Prints the worst ReadMix time and
+// how many blocks arrived too late, for 2 to 32 producers.
+void MixingContention(int sampleRate, double secondsPerCount)
+{
+	const size_t block = 64;
+	const auto period = std::chrono::duration<double>((double) block / sampleRate);
+
+	for (int producers = 2; producers <= 32; producers *= 2)
+	{
+		MixingRingBuffer mixer(producers, block * 8, block);
+		std::atomic<bool> running(true);
+		std::vector<std::thread> threads;
+
+		for (int p = 0; p < producers; ++p)
+		{
+			threads.emplace_back([&, p]()
+			{
+				std::vector<float> voice(block);
+				double phase = 0.0;
+				while (running.load(std::memory_order_relaxed))
+				{
+					if (mixer.GetAvailableWrite(p) < block)
+					{
+						std::this_thread::yield();
+						continue;
+					}
+					for (size_t i = 0; i < block; ++i, phase += 0.01 * (p + 1)) voice[i] = 0.1f * (float) sin(phase);
+					mixer.Write(p, voice.data(), block);
+				}
+			});
+		}
+
+		std::vector<float> out(block);
+		double worst = 0.0;
+		uint64_t blocks = 0;
+		const auto start = std::chrono::steady_clock::now();
+		auto next = start;
+
+		while (std::chrono::steady_clock::now() - start < std::chrono::duration<double>(secondsPerCount))
+		{
+			next += std::chrono::duration_cast<std::chrono::steady_clock::duration>(period);
+			std::this_thread::sleep_until(next);
+
+			const auto t0 = std::chrono::steady_clock::now();
+			mixer.ReadMix(out.data(), block);
+			worst = std::max(worst, std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - t0).count());
+			++blocks;
+		}
+
+		running = false;
+		for (auto & t : threads) t.join();
+
+		uint64_t missed = 0;
+		for (int p = 0; p < producers; ++p) missed += mixer.GetMissedBlocks(p);
+
+		std::cout << "[mix] " << producers << " producers: " << blocks << " blocks, worst ReadMix " << worst << " us, "
+			<< missed << " late voice blocks" << std::endl;
+	}
+}
+
+// Converts stereo noise from the filter rate to the device rate with each
+// quality preset and prints how many times faster than real time it runs
+void ResamplerBenchmark(int inputRate, int outputRate, double seconds)
+{
+	static const char * names[] = { "fast", "medium", "high" };
+	const size_t block = 512;
+
+	NoiseGenerator gen;
+	std::vector<float> left = gen.produce(NoiseGenerator::NoiseType::WHITE, inputRate, 1, seconds);
+	std::vector<float> right = gen.produce(NoiseGenerator::NoiseType::PINK, inputRate, 1, seconds);
+	const size_t frames = std::min(left.size(), right.size());
+
+	for (int q = RESAMPLE_FAST; q <= RESAMPLE_HIGH; ++q)
+	{
+		SampleRateConverter src(2, inputRate, outputRate, (ResampleQuality) q, block);
+		std::vector<float> outLeft(src.GetMaxOutput(block)), outRight(outLeft.size());
+		float * out[2] = { outLeft.data(), outRight.data() };
+		size_t produced = 0;
+
+		const auto t0 = std::chrono::steady_clock::now();
+		for (size_t i = 0; i < frames; i += block)
+		{
+			const float * in[2] = { left.data() + i, right.data() + i };
+			produced += src.Process(in, std::min(block, frames - i), out);
+		}
+		const double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+
+		std::cout << "[src] " << inputRate << " -> " << outputRate << " " << names[q] << " (" << src.GetTaps() << " taps): "
+			<< (produced / (double) outputRate) / elapsed << "x real time" << std::endl;
+	}
+}
+
+// Runs a fixed-point model and its float counterpart on the same half-scale
+// noise in Q31 and Q15, and prints the error against the float output (as
+// SNR) and its RMS level (noise floor) in dB relative to full scale
+template <typename Fixed, typename Float>
+void FixedPointCheck(const char * name, int sampleRate, const std::vector<float> & noise)
+{
+	const float cutoffs[] = { 200.0f, 2000.0f, 10000.0f };
+	const float resonances[] = { 0.1f, 0.9f };
+	const size_t n = noise.size();
+
+	for (float cutoff : cutoffs)
+	{
+		for (float resonance : resonances)
+		{
+			Float reference(sampleRate);
+			reference.SetCutoff(cutoff);
+			reference.SetResonance(resonance);
+			std::vector<float> expected(noise);
+			reference.Process(expected.data(), n);
+
+			Fixed q31(sampleRate), q15(sampleRate);
+			q31.SetCutoff(cutoff);
+			q31.SetResonance(resonance);
+			q15.SetCutoff(cutoff);
+			q15.SetResonance(resonance);
+
+			std::vector<int32_t> x31(n);
+			std::vector<int16_t> x15(n);
+			for (size_t i = 0; i < n; ++i)
+			{
+				x31[i] = moog_to_q(noise[i], 31);
+				x15[i] = (int16_t) moog_clamp32(llround(noise[i] * 32768.0), 32767);
+			}
+			q31.Process(x31.data(), n);
+			q15.Process(x15.data(), n);
+
+			double signal = 0.0, error31 = 0.0, error15 = 0.0;
+			for (size_t i = 0; i < n; ++i)
+			{
+				const double e31 = x31[i] / 2147483648.0 - expected[i];
+				const double e15 = x15[i] / 32768.0 - expected[i];
+				signal += (double) expected[i] * expected[i];
+				error31 += e31 * e31;
+				error15 += e15 * e15;
+			}
+
+			auto db = [n](double sumSquares) { return 10.0 * log10(std::max(sumSquares / n, 1e-30)); };
+			std::cout << "[fixed] " << name << " " << cutoff << " Hz, resonance " << resonance
+				<< ": Q31 SNR " << db(signal) - db(error31) << " dB, floor " << db(error31) << " dBFS"
+				<< "; Q15 SNR " << db(signal) - db(error15) << " dB, floor " << db(error15) << " dBFS" << std::endl;
+		}
+	}
+}
+
+void FixedPointCheck(int sampleRate, double seconds)
+{
+	NoiseGenerator gen;
+	std::vector<float> noise = gen.produce(NoiseGenerator::NoiseType::WHITE, sampleRate, 1, seconds);
+	for (auto & x : noise) x *= 0.5f;
+
+	FixedPointCheck<StilsonMoogFixed, StilsonMoog>("Stilson", sampleRate, noise);
+	FixedPointCheck<MusicDSPMoogFixed, MusicDSPMoog>("MusicDSP", sampleRate, noise);
+}
+
+// Runs HuovilainenMoog and the reference formulation it replaced on the same
+// noise with a cutoff sweep and resonance steps, and prints the largest
+// difference for each output mode and resonance range
+void HuovilainenReferenceCheck(int sampleRate, double seconds)
+{
+	static const char * names[] = { "LP1", "LP2", "LP3", "LP4", "HP1", "HP2", "HP3", "HP4", "BP2", "BP4" };
+	const float resonances[][2] = { { 0.0f, 0.9f }, { 0.9f, 1.1f } };
+	const uint32_t block = 64;
+
+	NoiseGenerator gen;
+	const std::vector<float> noise = gen.produce(NoiseGenerator::NoiseType::WHITE, sampleRate, 1, seconds);
+	const size_t blocks = noise.size() / block;
+
+	for (int m = LadderFilterBase::LP1; m <= LadderFilterBase::BP4; ++m)
+	{
+		for (const auto & range : resonances)
+		{
+			HuovilainenMoog model(sampleRate);
+			model.SetOutputMode((LadderFilterBase::OutputMode) m);
+
+			HuovilainenCoeffs coeffs = model.GetCoefficients();
+			HuovilainenReferenceState reference;
+			reference.Init();
+			reference.outputMode = (LadderFilterBase::OutputMode) m;
+
+			std::vector<float> a(noise), b(noise);
+			double maxDiff = 0.0, peak = 0.0;
+
+			for (size_t i = 0; i < blocks; ++i)
+			{
+				// Exponential sweep from 20 Hz to 18 kHz, resonance stepping every 32 blocks
+				const float cutoff = 20.0f * powf(900.0f, (float) i / blocks);
+				const float resonance = range[0] + (range[1] - range[0]) * ((i / 32) % 8) / 7.0f;
+				model.SetCutoff(cutoff);
+				model.SetResonance(resonance);
+				coeffs.SetCutoff(sampleRate, cutoff);
+				coeffs.SetResonance(resonance);
+
+				model.Process(a.data() + i * block, block);
+				moog_process_reference(coeffs, reference, b.data() + i * block, block);
+
+				for (size_t j = i * block; j < (i + 1) * block; ++j)
+				{
+					maxDiff = std::max(maxDiff, (double) fabs(a[j] - b[j]));
+					peak = std::max(peak, (double) fabs(b[j]));
+				}
+			}
+
+			std::cout << "[huovilainen] " << names[m] << " resonance " << range[0] << " to " << range[1]
+				<< ": max difference " << maxDiff << " (" << (peak > 0.0 ? maxDiff / peak : 0.0) << " of peak)" << std::endl;
+		}
+	}
+}
+
+// Opens the virtual device (plain and duplex) on the default API, lets it run
+// and destroys it with no hardware stream ever opened
+void VirtualDeviceLifetime(int sampleRate, double seconds)
+{
+	{
+		AudioDevice device(2, sampleRate);
+		device.OpenVirtual(VirtualClockConfig());
+		std::this_thread::sleep_for(std::chrono::duration<double>(seconds));
+		std::cout << "[virtual] " << device.GetStreamStats().callbacks << " callbacks" << std::endl;
+	}
+
+	{
+		HuovilainenMoog left(sampleRate);
+		HuovilainenMoog right(sampleRate);
+		std::vector<FilterChain> chains = { { &left }, { &right } };
+
+		AudioDevice device(2, sampleRate);
+		device.OpenVirtualDuplex(chains, VirtualClockConfig());
+		std::this_thread::sleep_for(std::chrono::duration<double>(seconds));
+		std::cout << "[virtual] duplex " << device.GetStreamStats().callbacks << " callbacks" << std::endl;
+	}
+}
 
 int main()
 {
@@ -61,6 +324,13 @@ int main()
 	//oberheimModel.Process(noiseSamples.data(), noiseSamples.size());
 	
 	device.Play(noiseSamples);
+
+	//XrunSweep(desiredSampleRate, 10.0);
+	//MixingContention(desiredSampleRate, 5.0);
+	//ResamplerBenchmark(desiredSampleRate, 48000, 10.0);
+	//VirtualDeviceLifetime(desiredSampleRate, 1.0);
+	//HuovilainenReferenceCheck(desiredSampleRate, 4.0);
+	//FixedPointCheck(desiredSampleRate, 2.0);
 	
 	return 0;
 }
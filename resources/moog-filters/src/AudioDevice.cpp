@@ -4,39 +4,482 @@
 #include <algorithm>
 #include <thread>
 #include <chrono>
+#include <atomic>
+#include <random>
 
-static RingBufferT<float> buffer(BUFFER_LENGTH);
+#if defined(_WIN32)
+	#define NOMINMAX
+	#include <windows.h>
+#else
+	#include <pthread.h>
+	#include <sched.h>
+	#include <sys/mman.h>
+#endif
+
+struct RealtimeState
+{
+	RealtimeProfile profile;
+	RealtimeReport report; // steps taken on the opening thread
+
+	// Steps taken on the callback thread during its first callback
+	std::atomic<bool> started { false };
+	std::atomic<int> scheduling { RT_SKIPPED };
+	std::atomic<int> callbackAffinity { RT_SKIPPED };
+	std::atomic<int> stackPrefault { RT_SKIPPED };
+	std::atomic<int> callbackPriority { -1 };
+	std::atomic<int> feederAffinity { RT_SKIPPED };
+};
+
+struct StreamState
+{
+	int numChannels = 0;
+	std::atomic<bool> playing { false }; // Play() is feeding the ring
+	std::atomic<uint64_t> callbacks { 0 };
+	std::atomic<uint64_t> xruns { 0 };
+	std::atomic<uint64_t> underruns { 0 };
+
+	// Device-format conversion, set up once the buffer size is known
+	std::unique_ptr<SampleConverter> converter;
+	std::vector<float> scratch; // interleaved, one callback buffer
+
+	// Planar blocks from Play(), PlayPlanar() or GetFrameRing(), one ring per device
+	FrameRingBuffer ring;
+
+	// Consumer side of the frame ring
+	std::vector<const float *> channels; // into the front block, past what was played
+	uint32_t blockOffset = 0; // frames of the front block already played
+	int64_t playhead = 0; // frames written to the device
+	int64_t expectedTime = 0; // sample time that continues the last block
+	int64_t origin = 0; // playhead minus sample time when the timeline (re)started
+	bool timed = false;
+	std::atomic<uint64_t> discontinuities { 0 };
+	std::atomic<int64_t> drift { 0 };
+
+	// Producer side: sample time of the next frame Play() writes
+	int64_t writeTime = 0;
+
+	RealtimeState * realtime = nullptr;
+
+	// Rendered by another process; replaces the local ring when set
+	SharedRingBuffer * shared = nullptr;
+};
+
+// Prefers float, then the widest integer format the device handles natively
+static SampleFormat moog_choose_format(RtAudioFormat native)
+{
+	if (!native || (native & RTAUDIO_FLOAT32)) return SAMPLE_FLOAT32;
+	if (native & RTAUDIO_SINT32) return SAMPLE_INT32;
+	if (native & RTAUDIO_SINT24) return SAMPLE_INT24;
+	if (native & RTAUDIO_SINT16) return SAMPLE_INT16;
+	return SAMPLE_FLOAT32;
+}
+
+static RtAudioFormat moog_rtaudio_format(SampleFormat format)
+{
+	switch (format)
+	{
+		case SAMPLE_INT16: return RTAUDIO_SINT16;
+		case SAMPLE_INT24: return RTAUDIO_SINT24;
+		case SAMPLE_INT32: return RTAUDIO_SINT32;
+		default: return RTAUDIO_FLOAT32;
+	}
+}
+
+static void moog_count_callback(StreamState * stream, RtAudioStreamStatus status)
+{
+	stream->callbacks.fetch_add(1, std::memory_order_relaxed);
+	if (status) stream->xruns.fetch_add(1, std::memory_order_relaxed);
+}
+
+static bool moog_pin_current_thread(int cpu)
+{
+#if defined(__linux__)
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#elif defined(_WIN32)
+	return cpu < 64 && SetThreadAffinityMask(GetCurrentThread(), DWORD_PTR(1) << cpu) != 0;
+#else
+	return false; // macOS only has affinity hints
+#endif
+}
+
+// RtAudio asks for SCHED_RR on some backends (or nothing at all), so the
+// callback thread promotes itself to SCHED_FIFO and reports what it ended up with
+static bool moog_promote_current_thread(int priority, int & observed)
+{
+#if defined(_WIN32)
+	SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_TIME_CRITICAL);
+	observed = GetThreadPriority(GetCurrentThread());
+	return observed == THREAD_PRIORITY_TIME_CRITICAL;
+#else
+	sched_param param;
+	param.sched_priority = std::max(sched_get_priority_min(SCHED_FIFO), std::min(priority, sched_get_priority_max(SCHED_FIFO)));
+	pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+
+	int policy;
+	if (pthread_getschedparam(pthread_self(), &policy, &param) != 0) return false;
+	observed = param.sched_priority;
+	return policy == SCHED_FIFO || policy == SCHED_RR;
+#endif
+}
+
+static bool moog_lock_memory()
+{
+#if defined(_WIN32)
+	return false;
+#else
+	return mlockall(MCL_CURRENT | MCL_FUTURE) == 0;
+#endif
+}
+
+static void moog_prefault_stack()
+{
+	volatile char stack[64 * 1024];
+	for (size_t i = 0; i < sizeof(stack); i += 1024) stack[i] = 0;
+}
+
+// One-time setup on the callback thread, a handful of syscalls before any audio is produced
+static void moog_realtime_callback_setup(RealtimeState * rt)
+{
+	if (!rt || rt->started.load(std::memory_order_acquire)) return;
+
+	const RealtimeProfile & profile = rt->profile;
+	if (profile.enabled)
+	{
+		int observed = -1;
+		rt->scheduling.store(moog_promote_current_thread(profile.priority, observed) ? RT_OK : RT_FAILED);
+		rt->callbackPriority.store(observed);
+
+		if (profile.callbackCpu >= 0) rt->callbackAffinity.store(moog_pin_current_thread(profile.callbackCpu) ? RT_OK : RT_FAILED);
+
+		if (profile.prefault)
+		{
+			moog_prefault_stack();
+			rt->stackPrefault.store(RT_OK);
+		}
+	}
+
+	rt->started.store(true, std::memory_order_release);
+}
+
+enum ProbeState
+{
+	PROBE_IDLE,
+	PROBE_ARMED,
+	PROBE_WAITING
+};
+
+struct DuplexState
+{
+	std::vector<FilterChain> chains;
+	int numChannels = 0;
+
+	std::atomic<int> probe { PROBE_IDLE };
+	std::atomic<long> probeResult { -1 };
+	long probeElapsed = 0;
+	float probeThreshold = 0.1f;
+
+	// Planar float copy of one callback buffer
+	unsigned int maxFrames = 0;
+	std::vector<float> planarData;
+	std::vector<float *> planar;
+
+	StreamState * stream = nullptr;
+};
 
 static int rt_callback(void * output_buffer, void * input_buffer, unsigned int num_bufferframes, double stream_time, RtAudioStreamStatus status, void * user_data)
 {
-	if (status) std::cerr << "[rtaudio] Buffer over or underflow" << std::endl;
+	StreamState * stream = (StreamState *) user_data;
+	moog_realtime_callback_setup(stream->realtime);
+	moog_count_callback(stream, status);
 
-	if (buffer.getAvailableRead()) 
+	// Planar blocks are interleaved (and converted) straight into the device
+	// buffer. Blocks and callbacks need not line up, so a block can be split
+	// across callbacks.
+	SampleConverter & converter = *stream->converter;
+	const size_t frameBytes = stream->numChannels * moog_sample_bytes(converter.GetFormat());
+	uint8_t * out = (uint8_t *) output_buffer;
+	uint32_t done = 0;
+
+	FrameBlock block;
+	while (done < num_bufferframes && stream->ring.peek(block))
 	{
-		buffer.read((float*) output_buffer, BUFFER_LENGTH);
-	} 
-	else
+		if (stream->blockOffset == 0)
+		{
+			// Timestamps that do not continue the previous block restart the timeline
+			const int64_t lag = stream->playhead + done - block.sampleTime;
+			if (!stream->timed || block.sampleTime != stream->expectedTime)
+			{
+				if (stream->timed) stream->discontinuities.fetch_add(1, std::memory_order_relaxed);
+				stream->origin = lag;
+				stream->timed = true;
+			}
+			stream->drift.store(lag - stream->origin, std::memory_order_relaxed);
+		}
+
+		const uint32_t count = std::min(num_bufferframes - done, block.frames - stream->blockOffset);
+		for (int c = 0; c < stream->numChannels; ++c) stream->channels[c] = block.channels[c] + stream->blockOffset;
+		converter.Write(stream->channels.data(), out + done * frameBytes, count);
+
+		done += count;
+		stream->blockOffset += count;
+
+		if (stream->blockOffset == block.frames)
+		{
+			stream->expectedTime = block.sampleTime + block.frames;
+			stream->blockOffset = 0;
+			stream->ring.pop();
+		}
+	}
+
+	if (done < num_bufferframes)
 	{
-		memset(output_buffer, 0, BUFFER_LENGTH * sizeof(float));
+		// All-zero bytes are silence in every supported format
+		memset(out + done * frameBytes, 0, (num_bufferframes - done) * frameBytes);
+		if (stream->playing.load(std::memory_order_relaxed)) stream->underruns.fetch_add(1, std::memory_order_relaxed);
 	}
 
+	stream->playhead += num_bufferframes;
+
 	return 0;
 }
 
-AudioDevice::AudioDevice(int numChannels, int sampleRate, int deviceId)
+static int rt_shared_callback(void * output_buffer, void * input_buffer, unsigned int num_bufferframes, double stream_time, RtAudioStreamStatus status, void * user_data)
+{
+	StreamState * stream = (StreamState *) user_data;
+	moog_realtime_callback_setup(stream->realtime);
+	moog_count_callback(stream, status);
+
+	SharedRingBuffer & shared = *stream->shared;
+
+	// Interleaved samples from another process. The negotiated buffer size
+	// can differ from the requested one, and can change between callbacks on
+	// some backends.
+	SampleConverter & converter = *stream->converter;
+	const bool native = converter.GetFormat() == SAMPLE_FLOAT32;
+	const int bytes = moog_sample_bytes(converter.GetFormat());
+	const size_t needed = num_bufferframes * stream->numChannels;
+	bool starved = false;
+
+	for (size_t offset = 0; offset < needed; offset += stream->scratch.size())
+	{
+		const size_t count = std::min(stream->scratch.size(), needed - offset);
+		float * block = native ? (float *) output_buffer + offset : stream->scratch.data();
+		const size_t available = std::min(shared.getAvailableRead(), count);
+
+		if (available) shared.read(block, available);
+
+		if (available < count)
+		{
+			memset(block + available, 0, (count - available) * sizeof(float));
+			starved = true;
+		}
+
+		if (!native) converter.Write(block, (uint8_t *) output_buffer + offset * bytes, count);
+	}
+
+	if (starved && shared.isProducerActive()) stream->underruns.fetch_add(1, std::memory_order_relaxed);
+
+	return 0;
+}
+
+// Loopback click on a planar block: looks for the click on input channel 0,
+// then replaces the block with silence (plus the click when newly armed)
+static void moog_probe_block(DuplexState * state, float * const * channels, unsigned int frames)
+{
+	int armed = PROBE_ARMED;
+	const bool emit = state->probe.compare_exchange_strong(armed, PROBE_WAITING, std::memory_order_acq_rel);
+	if (emit) state->probeElapsed = 0;
+
+	for (unsigned int i = 0; i < frames; ++i)
+	{
+		if (std::abs(channels[0][i]) > state->probeThreshold)
+		{
+			int waiting = PROBE_WAITING;
+			state->probeResult.store(state->probeElapsed + i, std::memory_order_relaxed);
+			state->probe.compare_exchange_strong(waiting, PROBE_IDLE, std::memory_order_release);
+			break;
+		}
+	}
+
+	for (int c = 0; c < state->numChannels; ++c) memset(channels[c], 0, frames * sizeof(float));
+	if (emit) channels[0][0] = 0.5f;
+
+	state->probeElapsed += frames;
+}
+
+// The device buffers are interleaved in the device's native format. Each block
+// is converted to planar float, so every channel is contiguous for the filters,
+// and converted back on the way out.
+static int rt_duplex_callback(void * output_buffer, void * input_buffer, unsigned int num_bufferframes, double stream_time, RtAudioStreamStatus status, void * user_data)
+{
+	DuplexState * state = (DuplexState *) user_data;
+	moog_realtime_callback_setup(state->stream->realtime);
+	moog_count_callback(state->stream, status);
+
+	SampleConverter & converter = *state->stream->converter;
+	uint8_t * output = (uint8_t *) output_buffer;
+	const uint8_t * input = (const uint8_t *) input_buffer;
+	const size_t frameBytes = state->numChannels * moog_sample_bytes(converter.GetFormat());
+
+	if (!input)
+	{
+		memset(output, 0, num_bufferframes * frameBytes);
+		return 0;
+	}
+
+	for (unsigned int offset = 0; offset < num_bufferframes; offset += state->maxFrames)
+	{
+		const unsigned int frames = std::min(state->maxFrames, num_bufferframes - offset);
+		converter.Read(input + offset * frameBytes, state->planar.data(), frames);
+
+		if (state->probe.load(std::memory_order_acquire) != PROBE_IDLE)
+		{
+			moog_probe_block(state, state->planar.data(), frames);
+		}
+		else
+		{
+			for (int c = 0; c < state->numChannels; ++c)
+			{
+				for (LadderFilterBase * filter : state->chains[c])
+				{
+					filter->Process(state->planar[c], frames);
+				}
+			}
+		}
+
+		converter.Write(state->planar.data(), output + offset * frameBytes, frames);
+	}
+
+	return 0;
+}
+
+struct VirtualClock
+{
+	VirtualClockConfig config;
+	RtAudioCallback callback = nullptr;
+	void * userData = nullptr;
+	bool duplex = false;
+
+	unsigned int frames = 0;
+	size_t frameBytes = 0;
+	double sampleRate = 0.0;
+
+	std::vector<uint8_t> output;
+	std::vector<uint8_t> input;
+	std::vector<uint8_t> loopback; // the last loopbackFrames of output
+
+	std::atomic<bool> running { false };
+	std::thread thread;
+
+	void Start()
+	{
+		output.assign(frames * frameBytes, 0);
+		input.assign(frames * frameBytes, 0);
+		if (config.loopbackFrames) config.loopbackFrames = std::max(config.loopbackFrames, frames);
+		loopback.assign(config.loopbackFrames * frameBytes, 0);
+
+		running.store(true);
+		thread = std::thread(&VirtualClock::Run, this);
+	}
+
+	void Stop()
+	{
+		running.store(false);
+		if (thread.joinable()) thread.join();
+	}
+
+	// Sleeps most of the way and spins the rest, since sleep_until alone can
+	// overshoot by more than a small buffer
+	static void WaitUntil(std::chrono::steady_clock::time_point t)
+	{
+		const auto margin = std::chrono::microseconds(200);
+		if (std::chrono::steady_clock::now() < t - margin) std::this_thread::sleep_until(t - margin);
+		while (std::chrono::steady_clock::now() < t) {}
+	}
+
+	void Run()
+	{
+		typedef std::chrono::steady_clock clock;
+
+		std::mt19937 rng(config.seed);
+		std::uniform_real_distribution<double> unit(0.0, 1.0);
+
+		const std::chrono::duration<double> period(frames / sampleRate);
+		const size_t blockBytes = frames * frameBytes;
+		const clock::time_point start = clock::now();
+
+		uint64_t k = 0;
+		RtAudioStreamStatus status = 0;
+
+		while (running.load(std::memory_order_relaxed))
+		{
+			const double jitter = config.jitterMs * 0.001 * unit(rng);
+			WaitUntil(start + std::chrono::duration_cast<clock::duration>(period * (double) k + std::chrono::duration<double>(jitter)));
+
+			if (config.stallMs > 0.0 && unit(rng) < config.stallProbability)
+			{
+				std::this_thread::sleep_for(std::chrono::duration<double, std::milli>(config.stallMs));
+			}
+
+			if (duplex && !loopback.empty()) memcpy(input.data(), loopback.data(), blockBytes);
+
+			callback(output.data(), duplex ? input.data() : nullptr, frames, k * frames / sampleRate, status, userData);
+
+			if (!loopback.empty())
+			{
+				memmove(loopback.data(), loopback.data() + blockBytes, loopback.size() - blockBytes);
+				memcpy(loopback.data() + loopback.size() - blockBytes, output.data(), blockBytes);
+			}
+
+			// Buffer k has to be ready by the start of period k + 1. A late buffer
+			// means the periods in between were lost, as on real hardware.
+			const double elapsed = std::chrono::duration<double>(clock::now() - start) / period;
+			if (elapsed > k + 1)
+			{
+				status = duplex ? (RTAUDIO_INPUT_OVERFLOW | RTAUDIO_OUTPUT_UNDERFLOW) : RTAUDIO_OUTPUT_UNDERFLOW;
+				k = (uint64_t) elapsed + 1;
+			}
+			else
+			{
+				status = 0;
+				++k;
+			}
+		}
+	}
+};
+
+AudioDevice::AudioDevice(int numChannels, int sampleRate, int deviceId, unsigned int frameSize)
 {
+	if (frameSize < MIN_FRAME_SIZE) throw std::runtime_error("frame size below 16 frames");
+
 	rtaudio = std::unique_ptr<RtAudio>(new RtAudio);
 	info.id = deviceId != -1 ? deviceId : rtaudio->getDefaultOutputDevice();
 	info.numChannels = numChannels;
 	info.sampleRate = sampleRate;
-	info.frameSize = FRAME_SIZE;
+	info.requestedFrameSize = frameSize;
+	info.frameSize = frameSize;
+	info.minimizeLatency = frameSize < FRAME_SIZE;
+
+	realtime = std::unique_ptr<RealtimeState>(new RealtimeState);
+	stream = std::unique_ptr<StreamState>(new StreamState);
+	stream->numChannels = numChannels;
+	stream->realtime = realtime.get();
+
+	// Resized to the negotiated buffer size once a stream opens
+	stream->ring.resize(numChannels, frameSize, 4);
 }
 
 AudioDevice::~AudioDevice()
 {
+	if (virtualClock) virtualClock->Stop();
+
 	if (rtaudio)
 	{
-		rtaudio->stopStream();
+		// Nothing to stop after OpenVirtual(), and a real backend throws if asked to
+		if (rtaudio->isStreamRunning()) rtaudio->stopStream();
 		if (rtaudio->isStreamOpen()) rtaudio->closeStream();
 	}
 }
@@ -50,10 +493,16 @@ bool AudioDevice::Open(const int deviceId)
 	parameters.nChannels = info.numChannels;
 	parameters.firstChannel = 0;
 
-	rtaudio->openStream(&parameters, NULL, RTAUDIO_FLOAT32, info.sampleRate, &info.frameSize, &rt_callback, (void*) & buffer);
+	RtAudio::StreamOptions options;
+	PrepareStream(options);
+
+	info.format = moog_choose_format(rtaudio->getDeviceInfo(info.id).nativeFormats);
+
+	rtaudio->openStream(&parameters, NULL, moog_rtaudio_format(info.format), info.sampleRate, &info.frameSize, stream->shared ? &rt_shared_callback : &rt_callback, (void*) stream.get(), &options);
 
 	if (rtaudio->isStreamOpen()) 
 	{
+		PreparePlayback();
 		rtaudio->startStream();
 		return true;
 	}
@@ -61,6 +510,245 @@ bool AudioDevice::Open(const int deviceId)
 	return false;
 }
 
+// Sets up conversion and the ring once info.frameSize holds the negotiated size
+void AudioDevice::PreparePlayback()
+{
+	stream->converter = std::unique_ptr<SampleConverter>(new SampleConverter(info.format, info.numChannels, info.frameSize, info.dither));
+	stream->scratch.assign(info.frameSize * info.numChannels, 0.0f);
+
+	// One callback buffer per block, with room for the feeder to stay a few
+	// callbacks ahead. Resizing zero-fills the slots, which also prefaults them.
+	stream->ring.resize(info.numChannels, info.frameSize, std::max<size_t>(4, BUFFER_LENGTH / info.frameSize));
+
+	stream->channels.assign(info.numChannels, nullptr);
+	stream->blockOffset = 0;
+	stream->playhead = 0;
+	stream->timed = false;
+	stream->writeTime = 0;
+}
+
+void AudioDevice::PrepareDuplex(const std::vector<FilterChain> & chains)
+{
+	if ((int) chains.size() != info.numChannels) throw std::runtime_error("one filter chain per channel required");
+
+	duplex = std::unique_ptr<DuplexState>(new DuplexState);
+	duplex->chains = chains;
+	duplex->numChannels = info.numChannels;
+	duplex->stream = stream.get();
+}
+
+void AudioDevice::PrepareDuplexBuffers()
+{
+	stream->converter = std::unique_ptr<SampleConverter>(new SampleConverter(info.format, info.numChannels, info.frameSize, info.dither));
+
+	duplex->maxFrames = info.frameSize;
+	duplex->planarData.assign(info.frameSize * info.numChannels, 0.0f);
+	duplex->planar.resize(info.numChannels);
+	for (int c = 0; c < info.numChannels; ++c) duplex->planar[c] = duplex->planarData.data() + c * info.frameSize;
+}
+
+bool AudioDevice::OpenDuplex(const int inputDeviceId, const std::vector<FilterChain> & chains)
+{
+	if (!rtaudio) throw std::runtime_error("rtaudio not created yet");
+
+	PrepareDuplex(chains);
+
+	RtAudio::StreamParameters outputParameters;
+	outputParameters.deviceId = info.id;
+	outputParameters.nChannels = info.numChannels;
+	outputParameters.firstChannel = 0;
+
+	RtAudio::StreamParameters inputParameters;
+	inputParameters.deviceId = inputDeviceId != -1 ? inputDeviceId : rtaudio->getDefaultInputDevice();
+	inputParameters.nChannels = info.numChannels;
+	inputParameters.firstChannel = 0;
+
+	RtAudio::StreamOptions options;
+	PrepareStream(options);
+
+	// RtAudio takes one format for both directions
+	const RtAudioFormat nativeOutput = rtaudio->getDeviceInfo(outputParameters.deviceId).nativeFormats;
+	const RtAudioFormat nativeInput = rtaudio->getDeviceInfo(inputParameters.deviceId).nativeFormats;
+	info.format = moog_choose_format(nativeOutput & nativeInput);
+
+	rtaudio->openStream(&outputParameters, &inputParameters, moog_rtaudio_format(info.format), info.sampleRate, &info.frameSize, &rt_duplex_callback, (void*) duplex.get(), &options);
+
+	if (rtaudio->isStreamOpen())
+	{
+		PrepareDuplexBuffers();
+		rtaudio->startStream();
+		return true;
+	}
+
+	return false;
+}
+
+bool AudioDevice::OpenVirtual(const VirtualClockConfig & config)
+{
+	if (IsOpen()) throw std::runtime_error("stream already open");
+
+	RtAudio::StreamOptions options;
+	PrepareStream(options);
+
+	info.format = config.format;
+	PreparePlayback();
+
+	virtualClock = std::unique_ptr<VirtualClock>(new VirtualClock);
+	virtualClock->config = config;
+	virtualClock->callback = stream->shared ? &rt_shared_callback : &rt_callback;
+	virtualClock->userData = stream.get();
+	virtualClock->frames = info.frameSize;
+	virtualClock->frameBytes = info.numChannels * moog_sample_bytes(info.format);
+	virtualClock->sampleRate = info.sampleRate;
+	virtualClock->Start();
+	return true;
+}
+
+bool AudioDevice::OpenVirtualDuplex(const std::vector<FilterChain> & chains, const VirtualClockConfig & config)
+{
+	if (IsOpen()) throw std::runtime_error("stream already open");
+
+	PrepareDuplex(chains);
+
+	RtAudio::StreamOptions options;
+	PrepareStream(options);
+
+	info.format = config.format;
+	PrepareDuplexBuffers();
+
+	virtualClock = std::unique_ptr<VirtualClock>(new VirtualClock);
+	virtualClock->config = config;
+	virtualClock->callback = &rt_duplex_callback;
+	virtualClock->userData = duplex.get();
+	virtualClock->duplex = true;
+	virtualClock->frames = info.frameSize;
+	virtualClock->frameBytes = info.numChannels * moog_sample_bytes(info.format);
+	virtualClock->sampleRate = info.sampleRate;
+	virtualClock->Start();
+	return true;
+}
+
+bool AudioDevice::IsOpen() const
+{
+	return (virtualClock && virtualClock->running.load()) || rtaudio->isStreamOpen();
+}
+
+bool AudioDevice::IsRunning() const
+{
+	return (virtualClock && virtualClock->running.load()) || rtaudio->isStreamRunning();
+}
+
+long AudioDevice::MeasureRoundTripLatency(double timeoutSeconds, float threshold)
+{
+	if (!duplex || !IsRunning()) return -1;
+
+	duplex->probeThreshold = threshold;
+	duplex->probeResult.store(-1, std::memory_order_relaxed);
+	duplex->probe.store(PROBE_ARMED, std::memory_order_release);
+
+	const auto deadline = std::chrono::steady_clock::now() + std::chrono::duration<double>(timeoutSeconds);
+	while (duplex->probe.load(std::memory_order_acquire) != PROBE_IDLE)
+	{
+		if (std::chrono::steady_clock::now() > deadline)
+		{
+			// The callback may have finished the probe in the meantime
+			int waiting = PROBE_WAITING;
+			int armed = PROBE_ARMED;
+			if (duplex->probe.compare_exchange_strong(waiting, PROBE_IDLE) || duplex->probe.compare_exchange_strong(armed, PROBE_IDLE)) return -1;
+			break;
+		}
+		std::this_thread::sleep_for(std::chrono::milliseconds(5));
+	}
+
+	return duplex->probeResult.load(std::memory_order_relaxed);
+}
+
+long AudioDevice::GetReportedLatency() const
+{
+	if (virtualClock) return virtualClock->config.loopbackFrames ? virtualClock->config.loopbackFrames : info.frameSize;
+	if (!rtaudio->isStreamOpen()) return -1;
+	return rtaudio->getStreamLatency() + info.frameSize;
+}
+
+void AudioDevice::SetRealtimeProfile(const RealtimeProfile & profile)
+{
+	if (IsOpen()) throw std::runtime_error("real-time profile must be set before the stream is opened");
+	realtime->profile = profile;
+}
+
+// Applies the steps that have to happen before the stream exists
+void AudioDevice::PrepareStream(RtAudio::StreamOptions & options)
+{
+	const RealtimeProfile & profile = realtime->profile;
+	realtime->report = RealtimeReport();
+	realtime->started.store(false);
+
+	// Backends that do not support a flag ignore it
+	if (info.minimizeLatency) options.flags |= RTAUDIO_MINIMIZE_LATENCY;
+	if (info.hogDevice) options.flags |= RTAUDIO_HOG_DEVICE;
+
+	if (!profile.enabled) return;
+
+	options.flags |= RTAUDIO_SCHEDULE_REALTIME;
+	options.priority = profile.priority;
+
+	// MCL_FUTURE also covers the buffers RtAudio allocates when the stream opens
+	if (profile.lockMemory) realtime->report.memoryLock = moog_lock_memory() ? RT_OK : RT_FAILED;
+}
+
+void AudioDevice::SetSharedSource(SharedRingBuffer * ring)
+{
+	if (IsOpen()) throw std::runtime_error("stream already open");
+	if (ring && !ring->isOpen()) throw std::runtime_error("shared ring not open");
+	stream->shared = ring;
+}
+
+StreamStats AudioDevice::GetStreamStats() const
+{
+	StreamStats stats;
+	stats.callbacks = stream->callbacks.load(std::memory_order_relaxed);
+	stats.xruns = stream->xruns.load(std::memory_order_relaxed);
+	stats.underruns = stream->underruns.load(std::memory_order_relaxed);
+	stats.discontinuities = stream->discontinuities.load(std::memory_order_relaxed);
+	stats.drift = stream->drift.load(std::memory_order_relaxed);
+	return stats;
+}
+
+void AudioDevice::ResetStreamStats()
+{
+	stream->callbacks.store(0);
+	stream->xruns.store(0);
+	stream->underruns.store(0);
+	stream->discontinuities.store(0);
+}
+
+RealtimeReport AudioDevice::GetRealtimeReport() const
+{
+	RealtimeReport report = realtime->report;
+	const RealtimeProfile & profile = realtime->profile;
+	if (!profile.enabled) return report;
+
+	const bool started = realtime->started.load(std::memory_order_acquire);
+	report.scheduling = started ? (RealtimeStep) realtime->scheduling.load() : RT_PENDING;
+	report.callbackPriority = realtime->callbackPriority.load();
+	if (profile.callbackCpu >= 0) report.callbackAffinity = started ? (RealtimeStep) realtime->callbackAffinity.load() : RT_PENDING;
+	if (profile.prefault) report.prefault = started ? (RealtimeStep) realtime->stackPrefault.load() : RT_PENDING;
+	report.feederAffinity = (RealtimeStep) realtime->feederAffinity.load();
+	return report;
+}
+
+void AudioDevice::PrintRealtimeReport(const RealtimeReport & report)
+{
+	static const char * names[] = { "skipped", "pending", "ok", "FAILED" };
+
+	std::cout << "[rtaudio] Real-time profile\n";
+	std::cout << "\tScheduling: " << names[report.scheduling] << " (priority " << report.callbackPriority << ")\n";
+	std::cout << "\tMemory lock: " << names[report.memoryLock] << "\n";
+	std::cout << "\tPrefault: " << names[report.prefault] << "\n";
+	std::cout << "\tCallback affinity: " << names[report.callbackAffinity] << "\n";
+	std::cout << "\tFeeder affinity: " << names[report.feederAffinity] << std::endl;
+}
+
 void AudioDevice::ListAudioDevices()
 {
 	std::unique_ptr<RtAudio> tempDevice(new RtAudio);
@@ -80,19 +768,67 @@ void AudioDevice::ListAudioDevices()
 
 bool AudioDevice::Play(const std::vector<float> & data)
 {
-	if (!rtaudio->isStreamOpen()) return false;
-	
-	// Each frame is the (size/2) cause interleaved channels! 
-	int sizeInFrames = ((int) data.size()) / (BUFFER_LENGTH);
-	
-	int writeCount = 0;
+	if (!IsOpen()) return false;
+
+	const RealtimeProfile & profile = realtime->profile;
+	if (profile.enabled && profile.feederCpu >= 0 && realtime->feederAffinity.load() == RT_SKIPPED)
+	{
+		realtime->feederAffinity.store(moog_pin_current_thread(profile.feederCpu) ? RT_OK : RT_FAILED);
+	}
 	
-	while(writeCount < sizeInFrames)
+	// One negotiated callback buffer per block, deinterleaved into the slot.
+	// The last block may be shorter; an incomplete trailing frame is ignored.
+	const size_t frames = data.size() / info.numChannels;
+	const uint32_t blockFrames = stream->ring.getBlockFrames();
+
+	stream->playing.store(true);
+
+	for (size_t offset = 0; offset < frames; )
+	{
+		const uint32_t count = (uint32_t) std::min<size_t>(blockFrames, frames - offset);
+		if (stream->ring.writeInterleaved(data.data() + offset * info.numChannels, count, stream->writeTime))
+		{
+			offset += count;
+			stream->writeTime += count;
+		}
+	}
+
+	stream->playing.store(false);
+
+	return true;
+}
+
+bool AudioDevice::PlayPlanar(const float * const * channels, size_t frames)
+{
+	if (!IsOpen()) return false;
+
+	const uint32_t blockFrames = stream->ring.getBlockFrames();
+	std::vector<const float *> block(info.numChannels);
+
+	stream->playing.store(true);
+
+	for (size_t offset = 0; offset < frames; )
 	{
-		bool status = buffer.write((data.data() + (writeCount * BUFFER_LENGTH)), BUFFER_LENGTH);
-		if (status)
-			writeCount++;
+		const uint32_t count = (uint32_t) std::min<size_t>(blockFrames, frames - offset);
+		for (int c = 0; c < info.numChannels; ++c) block[c] = channels[c] + offset;
+		if (stream->ring.write(block.data(), count, stream->writeTime))
+		{
+			offset += count;
+			stream->writeTime += count;
+		}
 	}
 
+	stream->playing.store(false);
+
 	return true;
+}
+
+FrameRingBuffer & AudioDevice::GetFrameRing()
+{
+	return stream->ring;
+}
+
+int64_t AudioDevice::GetWriteTime() const
+{
+	return stream->writeTime;
 }
\ No newline at end of file
@@ -6,13 +6,18 @@
 // This file implements a simple sound file player based on RtAudio for testing / example purposes.
 
 #include "Util.h"
-#include "RingBuffer.h"
+#include "FrameRingBuffer.h"
+#include "SharedRingBuffer.h"
+#include "LadderFilterBase.h"
+#include "SampleConverter.h"
 #include "rtaudio/RtAudio.h"
 
 #include <iostream>
 #include <memory>
+#include <vector>
 
 static const unsigned int FRAME_SIZE = 512;
+static const unsigned int MIN_FRAME_SIZE = 16;
 static const int CHANNELS = 2;
 static const int BUFFER_LENGTH = FRAME_SIZE * CHANNELS;
 
@@ -21,20 +26,143 @@ struct DeviceInfo
 	int id;
 	int numChannels;
 	int sampleRate;
-	unsigned int frameSize;
+	unsigned int requestedFrameSize;
+	unsigned int frameSize; // as negotiated once the stream is open
+	bool minimizeLatency = false; // RTAUDIO_MINIMIZE_LATENCY, on by default below FRAME_SIZE
+	bool hogDevice = false; // RTAUDIO_HOG_DEVICE
+	SampleFormat format = SAMPLE_FLOAT32; // picked from the device's native formats on open
+	DitherType dither = DITHER_TRIANGULAR; // applied when format is 16 or 24 bit
 	bool isPlaying = false;
 };
 
+struct StreamStats
+{
+	uint64_t callbacks = 0;
+	uint64_t xruns = 0; // over/underflows reported by the driver
+	uint64_t underruns = 0; // callbacks the ring could not fill while Play() was feeding it
+	uint64_t discontinuities = 0; // blocks whose sample time did not continue the previous block
+	int64_t drift = 0; // frames the output has fallen behind the block timestamps since the timeline started
+};
+
+// Insert effect for one channel of a duplex stream, applied in order. The
+// filters are owned by the caller and must outlive the stream.
+typedef std::vector<LadderFilterBase *> FilterChain;
+
+// Opt-in real-time setup for the audio path. Every step is attempted on its
+// own and its outcome is reported separately, since most of them depend on
+// privileges (rtprio and memlock limits) that vary between machines.
+struct RealtimeProfile
+{
+	bool enabled = false;
+	int priority = 80; // SCHED_FIFO priority of the callback thread
+	bool lockMemory = true; // mlockall(MCL_CURRENT | MCL_FUTURE) before the stream opens
+	bool prefault = true; // touch the ring, the duplex state and the callback stack up front
+	int callbackCpu = -1; // -1 leaves the thread unpinned
+	int feederCpu = -1; // the thread that calls Play()
+};
+
+enum RealtimeStep
+{
+	RT_SKIPPED,
+	RT_PENDING, // runs on the callback thread, which has not started yet
+	RT_OK,
+	RT_FAILED
+};
+
+struct RealtimeReport
+{
+	RealtimeStep scheduling = RT_SKIPPED;
+	RealtimeStep memoryLock = RT_SKIPPED;
+	RealtimeStep prefault = RT_SKIPPED;
+	RealtimeStep callbackAffinity = RT_SKIPPED;
+	RealtimeStep feederAffinity = RT_SKIPPED;
+	int callbackPriority = -1; // as observed from the callback thread
+};
+
+// Headless stand-in for a sound card (see AudioDevice::OpenVirtual) with
+// injectable timing faults
+struct VirtualClockConfig
+{
+	SampleFormat format = SAMPLE_FLOAT32; // device format to simulate
+	double jitterMs = 0.0; // each callback starts up to this much late
+	double stallProbability = 0.0; // chance per callback of a stall before it runs
+	double stallMs = 0.0;
+	unsigned int loopbackFrames = 0; // duplex input is the output delayed by this much (at least one buffer), 0 for silence
+	uint32_t seed = 1;
+};
+
+struct DuplexState;
+struct RealtimeState;
+struct StreamState;
+struct VirtualClock;
+
 class AudioDevice
 {
 	NO_MOVE(AudioDevice);
 	std::unique_ptr<RtAudio> rtaudio;
+	std::unique_ptr<DuplexState> duplex;
+	std::unique_ptr<RealtimeState> realtime;
+	std::unique_ptr<StreamState> stream;
+	std::unique_ptr<VirtualClock> virtualClock;
+	void PrepareStream(RtAudio::StreamOptions & options);
+	void PreparePlayback();
+	void PrepareDuplex(const std::vector<FilterChain> & chains);
+	void PrepareDuplexBuffers();
+	bool IsRunning() const;
 public:
 	static void ListAudioDevices();
-	AudioDevice(int numChannels, int sampleRate, int deviceId = -1);
+	static void PrintRealtimeReport(const RealtimeReport & report);
+	AudioDevice(int numChannels, int sampleRate, int deviceId = -1, unsigned int frameSize = FRAME_SIZE);
 	~AudioDevice();
 	bool Open(const int deviceId);
 	bool Play(const std::vector<float> & data);
+
+	// Same as Play() for planar channels, which go into the ring without
+	// being interleaved first
+	bool PlayPlanar(const float * const * channels, size_t frames);
+
+	// For rendering straight into ring slots with beginWrite()/endWrite().
+	// Blocks are timestamped in frames; a timestamp that does not continue
+	// the previous block counts as a discontinuity.
+	FrameRingBuffer & GetFrameRing();
+
+	// Sample time Play() and PlayPlanar() give their next block
+	int64_t GetWriteTime() const;
+
+	// Live input mode: every input buffer is run through chains[channel]
+	// inside the audio callback and written straight to the output
+	bool OpenDuplex(const int inputDeviceId, const std::vector<FilterChain> & chains);
+
+	// Virtual device: a timer thread calls the same callbacks at the configured
+	// sample rate and buffer size, so the whole pipeline runs without hardware.
+	// A callback that finishes after its buffer's deadline counts as an xrun.
+	bool OpenVirtual(const VirtualClockConfig & config);
+	bool OpenVirtualDuplex(const std::vector<FilterChain> & chains, const VirtualClockConfig & config);
+
+	bool IsOpen() const;
+
+	// Plays interleaved audio another process writes into a shared ring
+	// instead of the samples passed to Play(). The callback reads straight
+	// from the shared mapping into the device buffer. Must be set before
+	// Open() or OpenVirtual(); the ring has to stay open while the stream runs.
+	void SetSharedSource(SharedRingBuffer * ring);
+
+	// Sends a click on channel 0 and times its arrival on input channel 0.
+	// Needs a loopback path (cable or speaker to mic); returns the round trip
+	// in frames, or -1 if nothing above threshold arrived before the timeout.
+	long MeasureRoundTripLatency(double timeoutSeconds = 2.0, float threshold = 0.1f);
+
+	// Buffering latency reported by the driver plus one callback buffer, in
+	// frames. For the virtual device, the loopback delay (or one buffer).
+	long GetReportedLatency() const;
+
+	// Must be set before Open() or OpenDuplex()
+	void SetRealtimeProfile(const RealtimeProfile & profile);
+	RealtimeReport GetRealtimeReport() const;
+
+	StreamStats GetStreamStats() const;
+	void ResetStreamStats();
+
 	DeviceInfo info;
 };
 
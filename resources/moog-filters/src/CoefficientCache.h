@@ -0,0 +1,232 @@
+#pragma once
+
+#ifndef COEFFICIENT_CACHE_H
+#define COEFFICIENT_CACHE_H
+
+#include "LadderFilterBase.h"
+#include "Util.h"
+
+#include <atomic>
+#include <memory>
+#include <vector>
+
+/*
+Shares coefficient blocks between voices that run the same model at the same
+cutoff and resonance, as in unison or paraphonic patches. Each distinct
+parameter set is computed once, and every voice asking for it gets a
+reference-counted handle to the same immutable block, which it passes to the
+model's SetCoefficients().
+
+Coeffs is one of the models' coefficient structs (e.g. KrajeskiMoog::Coeffs).
+It must provide SetCutoff(sampleRate, cutoff), SetResonance(resonance) and the
+cutoff and resonance members they set.
+
+CoefficientSlot is the model side: the coefficients a voice runs on, either
+its own copy or a shared block. LadderModel is the base of the model classes
+that holds one State and a CoefficientSlot.
+
+Typical use is one Get() per voice per block. Entries that no voice refers to
+any more are recomputed in place for new parameter sets, so once the cache has
+grown to the number of distinct settings in use it does not allocate.
+
+The cache itself is not thread-safe and has to be used from one thread.
+Handles may be released on any thread: an entry is only rewritten after an
+acquire fence on seeing itself as the sole owner, which orders the write after
+the other thread's last use. The cache always keeps a reference to every block
+it handed out, including those Clear() drops, so a voice releasing a handle
+never frees memory. Get() does not free either; blocks Clear() dropped are
+freed by Collect(), the next Clear() or the destructor once no voice holds
+them.
+*/
+
+template <typename Coeffs>
+class CoefficientCache
+{
+	NO_COPY(CoefficientCache);
+
+public:
+
+	typedef std::shared_ptr<const Coeffs> Handle;
+
+	CoefficientCache(float sampleRate, size_t reserve = 16) : sampleRate(sampleRate)
+	{
+		entries.reserve(reserve);
+		for (size_t i = 0; i < reserve; ++i) entries.push_back(MakeEntry());
+	}
+
+	// The shared block for this parameter set, computed on first use. The
+	// reference is valid until the next call.
+	const Handle & Get(float cutoff, float resonance)
+	{
+		Entry * unused = nullptr;
+
+		for (auto & e : entries)
+		{
+			if (e.valid && e.block->cutoff == cutoff && e.block->resonance == resonance)
+			{
+				++hits;
+				return e.handle;
+			}
+
+			// Only the cache holds it, so nobody sees it change
+			if (!unused && e.handle.use_count() == 1) unused = &e;
+		}
+
+		if (!unused)
+		{
+			entries.push_back(MakeEntry());
+			unused = &entries.back();
+		}
+		else
+		{
+			// Pairs with the release in the other owners' decrements
+			std::atomic_thread_fence(std::memory_order_acquire);
+		}
+
+		unused->block->SetCutoff(sampleRate, cutoff);
+		unused->block->SetResonance(resonance);
+		unused->valid = true;
+
+		++misses;
+		return unused->handle;
+	}
+
+	// Forgets all parameter sets, e.g. after a sample rate change. Voices keep
+	// the blocks they hold, see Collect(). Allocates.
+	void Clear()
+	{
+		Collect();
+
+		for (auto & e : entries)
+		{
+			if (e.handle.use_count() > 1)
+			{
+				retired.push_back(e.handle);
+				e = MakeEntry();
+			}
+			e.valid = false;
+		}
+	}
+
+	// Frees the blocks from before a Clear() that no voice holds any more. For
+	// when freeing memory is acceptable on the cache's thread.
+	void Collect()
+	{
+		for (size_t i = 0; i < retired.size();)
+		{
+			if (retired[i].use_count() == 1)
+			{
+				std::swap(retired[i], retired.back());
+				retired.pop_back();
+			}
+			else
+			{
+				++i;
+			}
+		}
+	}
+
+	void SetSampleRate(float sr)
+	{
+		sampleRate = sr;
+		Clear();
+	}
+
+	size_t GetSize() const { return entries.size(); }
+	size_t GetRetired() const { return retired.size(); }
+	uint64_t GetHits() const { return hits; }
+	uint64_t GetMisses() const { return misses; }
+
+private:
+
+	struct Entry
+	{
+		Handle handle;
+		Coeffs * block; // the same block, writable while only the cache holds it
+		bool valid;
+	};
+
+	static Entry MakeEntry()
+	{
+		std::shared_ptr<Coeffs> block = std::make_shared<Coeffs>();
+		return Entry { block, block.get(), false };
+	}
+
+	std::vector<Entry> entries;
+	std::vector<Handle> retired; // dropped by Clear() while voices held them
+	float sampleRate;
+	uint64_t hits = 0;
+	uint64_t misses = 0;
+};
+
+// Coefficients of one voice: a private block that SetCutoff and SetResonance
+// edit, or a shared one until the next edit
+template <typename Coeffs>
+class CoefficientSlot
+{
+	NO_COPY(CoefficientSlot);
+
+public:
+
+	CoefficientSlot() : own(), current(&own) {}
+
+	const Coeffs & Get() const { return *current; }
+
+	// The private block, seeded from the shared one if there is one
+	Coeffs & Edit()
+	{
+		if (current != &own)
+		{
+			own = *current;
+			current = &own;
+			shared.reset();
+		}
+		return own;
+	}
+
+	void Share(const std::shared_ptr<const Coeffs> & c)
+	{
+		if (c.get() == current) return;
+		shared = c;
+		current = c.get();
+	}
+
+private:
+
+	Coeffs own;
+	const Coeffs * current;
+	std::shared_ptr<const Coeffs> shared;
+};
+
+// One voice of a model: its State and the Coeffs it runs on. The model sets
+// cutoff and resonance through coeffs.Edit(), or runs on a shared block.
+template <typename CoeffsT, typename StateT>
+class LadderModel : public LadderFilterBase
+{
+public:
+
+	typedef CoeffsT Coeffs;
+	typedef StateT State;
+
+	LadderModel(float sampleRate) : LadderFilterBase(sampleRate) {}
+
+	// Runs on a block shared with other voices, computed for this sample rate,
+	// until the next SetCutoff or SetResonance. Models that report cutoff or
+	// resonance differently from the block override it.
+	virtual void SetCoefficients(const std::shared_ptr<const Coeffs> & c)
+	{
+		coeffs.Share(c);
+		cutoff = c->cutoff;
+		resonance = c->resonance;
+	}
+
+	const Coeffs & GetCoefficients() const { return coeffs.Get(); }
+	State & GetState() { return state; }
+
+protected:
+
+	State state;
+	CoefficientSlot<Coeffs> coeffs;
+};
+
+#endif
@@ -0,0 +1,451 @@
+#pragma once
+
+#ifndef CONVOLVER_H
+#define CONVOLVER_H
+
+#include "Util.h"
+#include "LadderFilterBase.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+#include <string.h>
+
+/*
+Real-input FFT of a power-of-two size N, computed as a complex FFT of N / 2
+points on the even and odd samples followed by a split step. Spectra hold
+N / 2 + 1 bins as interleaved real and imaginary parts. Forward is unscaled
+and Inverse carries the 1 / N, so Inverse(Forward(x)) == x. Tables are built
+up front and the transforms do not allocate.
+*/
+
+class RealFFT
+{
+public:
+
+	RealFFT(size_t size) : N(size), M(size / 2)
+	{
+		if (N < 4 || (N & (N - 1))) throw std::runtime_error("FFT size must be a power of two of at least 4");
+
+		twiddle.resize(M);
+		for (size_t k = 0; k < M / 2; ++k)
+		{
+			twiddle[2 * k] = (float) cos(-2.0 * MOOG_PI * k / M);
+			twiddle[2 * k + 1] = (float) sin(-2.0 * MOOG_PI * k / M);
+		}
+
+		split.resize(M + 2);
+		for (size_t k = 0; k <= M / 2; ++k)
+		{
+			split[2 * k] = (float) cos(-2.0 * MOOG_PI * k / N);
+			split[2 * k + 1] = (float) sin(-2.0 * MOOG_PI * k / N);
+		}
+
+		reversed.resize(M);
+		int bits = 0;
+		while (((size_t) 1 << bits) < M) ++bits;
+		for (size_t i = 0; i < M; ++i)
+		{
+			size_t r = 0;
+			for (int b = 0; b < bits; ++b) r |= ((i >> b) & 1) << (bits - 1 - b);
+			reversed[i] = r;
+		}
+
+		work.resize(N);
+	}
+
+	size_t GetSize() const { return N; }
+	size_t GetNumBins() const { return M + 1; }
+
+	// N real samples to M + 1 complex bins
+	void Forward(const float * in, float * spectrum)
+	{
+		float * z = work.data();
+		memcpy(z, in, N * sizeof(float));
+		Transform(z, false);
+
+		// X[k] = E[k] + W^k O[k], with E and O untangled from Z[k] and Z[M - k]
+		for (size_t k = 0; k <= M / 2; ++k)
+		{
+			const size_t j = (M - k) & (M - 1);
+			const float zr = z[2 * k], zi = z[2 * k + 1];
+			const float cr = z[2 * j], ci = -z[2 * j + 1];
+
+			const float er = 0.5f * (zr + cr), ei = 0.5f * (zi + ci);
+			const float or_ = 0.5f * (zi - ci), oi = -0.5f * (zr - cr);
+
+			const float wr = split[2 * k], wi = split[2 * k + 1];
+			const float tr = wr * or_ - wi * oi, ti = wr * oi + wi * or_;
+
+			spectrum[2 * k] = er + tr;
+			spectrum[2 * k + 1] = ei + ti;
+
+			// Bin M - k from the conjugate symmetric pair
+			spectrum[2 * (M - k)] = er - tr;
+			spectrum[2 * (M - k) + 1] = -(ei - ti);
+		}
+	}
+
+	// M + 1 complex bins to N real samples
+	void Inverse(const float * spectrum, float * out)
+	{
+		float * z = work.data();
+
+		for (size_t k = 0; k <= M / 2; ++k)
+		{
+			const size_t j = M - k;
+			const float xr = spectrum[2 * k], xi = spectrum[2 * k + 1];
+			const float yr = spectrum[2 * j], yi = -spectrum[2 * j + 1];
+
+			const float er = 0.5f * (xr + yr), ei = 0.5f * (xi + yi);
+			const float dr = 0.5f * (xr - yr), di = 0.5f * (xi - yi);
+
+			// O[k] = D[k] / W^k, and Z[k] = E[k] + i O[k]
+			const float wr = split[2 * k], wi = -split[2 * k + 1];
+			const float or_ = dr * wr - di * wi, oi = dr * wi + di * wr;
+
+			z[2 * k] = er - oi;
+			z[2 * k + 1] = ei + or_;
+
+			if (k && k < M / 2 + (M == 1))
+			{
+				// Z[M - k] = conj(E[k]) + i conj(O[k])
+				z[2 * j] = er + oi;
+				z[2 * j + 1] = -ei + or_;
+			}
+		}
+
+		Transform(z, true);
+
+		const float scale = 1.0f / M;
+		for (size_t i = 0; i < N; ++i) out[i] = z[i] * scale;
+	}
+
+private:
+
+	// In-place radix-2 complex FFT of M points, unscaled
+	void Transform(float * z, bool inverse)
+	{
+		for (size_t i = 0; i < M; ++i)
+		{
+			const size_t r = reversed[i];
+			if (r > i)
+			{
+				std::swap(z[2 * i], z[2 * r]);
+				std::swap(z[2 * i + 1], z[2 * r + 1]);
+			}
+		}
+
+		const float sign = inverse ? -1.0f : 1.0f;
+		for (size_t len = 2; len <= M; len <<= 1)
+		{
+			const size_t half = len / 2;
+			const size_t stride = M / len;
+			for (size_t start = 0; start < M; start += len)
+			{
+				for (size_t k = 0; k < half; ++k)
+				{
+					const float wr = twiddle[2 * k * stride], wi = sign * twiddle[2 * k * stride + 1];
+					float * a = z + 2 * (start + k);
+					float * b = a + 2 * half;
+					const float tr = wr * b[0] - wi * b[1];
+					const float ti = wr * b[1] + wi * b[0];
+					b[0] = a[0] - tr;
+					b[1] = a[1] - ti;
+					a[0] += tr;
+					a[1] += ti;
+				}
+			}
+		}
+	}
+
+	size_t N, M;
+	std::vector<float> twiddle; // M / 2 complex
+	std::vector<float> split; // M / 2 + 1 complex
+	std::vector<size_t> reversed;
+	std::vector<float> work;
+};
+
+/*
+Uniformly partitioned convolution with an impulse response, for cabinet and
+room stages after the filter. The first blockSize taps run as a direct-form
+FIR, so there is no latency; the rest of the response is cut into partitions
+of blockSize taps that are applied in the frequency domain by overlap-save
+with a frequency-domain delay line. The partitioned part has one block of
+latency, which is exactly the head's length, so the two line up.
+
+Process() takes any n, like the ladder models, and only touches buffers sized
+in the constructor. A convolver has no cutoff or resonance; SetCutoff() and
+SetResonance() just store the value so it can sit in a FilterChain.
+
+With threads > 0, partitions from tailStart on are multiplied and accumulated
+by worker threads. The tail for block j only needs input spectra up to block
+j - tailStart, so a worker starts on it tailStart - 1 blocks before it is
+due. Workers poll for new blocks a few times per block period; the audio
+thread never blocks or signals them, it only publishes the block index and
+adds up finished results. If a worker's tail for a block is not done when the
+block is due, the audio thread computes those partitions itself, counts it in
+GetLateTails() and ignores whatever the worker produces for that block. A
+worker that has fallen behind skips ahead to the first block that is not due
+yet.
+*/
+
+class PartitionedConvolver : public LadderFilterBase
+{
+	NO_COPY(PartitionedConvolver);
+
+public:
+
+	PartitionedConvolver(float sampleRate, const float * ir, size_t irLength, uint32_t blockSize = 128, int threads = 0, int tailStart = 4)
+	: LadderFilterBase(sampleRate), B(blockSize), fft(2 * blockSize), bins(blockSize + 1)
+	{
+		if (B < 2 || (B & (B - 1))) throw std::runtime_error("block size must be a power of two");
+
+		cutoff = 0.0f;
+		resonance = 0.0f;
+
+		head.assign(B, 0.0f);
+		std::copy(ir, ir + std::min<size_t>(irLength, B), head.begin());
+
+		const size_t body = irLength > B ? irLength - B : 0;
+		P = (body + B - 1) / B;
+		K = std::max(1, std::min(tailStart, (int) P));
+
+		std::vector<float> segment(2 * B);
+		spectra.resize(P * 2 * bins);
+		for (size_t p = 0; p < P; ++p)
+		{
+			std::fill(segment.begin(), segment.end(), 0.0f);
+			const size_t from = B + p * B;
+			std::copy(ir + from, ir + std::min(irLength, from + B), segment.begin());
+			fft.Forward(segment.data(), spectra.data() + p * 2 * bins);
+		}
+
+		L = P + K + 1;
+		delayLine.assign(L * 2 * bins, 0.0f);
+		input.assign(2 * B, 0.0f);
+		timeDomain.assign(2 * B, 0.0f);
+		accumulator.assign(2 * bins, 0.0f);
+		bodyOutput.assign(B, 0.0f);
+
+		pollInterval = std::chrono::duration<double>(0.25 * B / sampleRate);
+
+		// Tail ranges, one per worker
+		const int tailPartitions = (int) P - K;
+		const int workerCount = tailPartitions > 0 ? std::min(threads, tailPartitions) : 0;
+		for (int w = 0; w < workerCount; ++w)
+		{
+			std::unique_ptr<Worker> worker(new Worker);
+			worker->first = K + tailPartitions * w / workerCount;
+			worker->last = K + tailPartitions * (w + 1) / workerCount;
+			worker->sums.assign((K + 1) * 2 * bins, 0.0f);
+			worker->slots.reset(new std::atomic<int64_t>[K + 1]);
+			for (int k = 0; k <= K; ++k) worker->slots[k].store(-1);
+			workers.push_back(std::move(worker));
+		}
+
+		Reset();
+
+		for (auto & worker : workers)
+		{
+			Worker * w = worker.get();
+			w->thread = std::thread([this, w]() { Run(*w); });
+		}
+	}
+
+	virtual ~PartitionedConvolver()
+	{
+		running.store(false);
+		for (auto & worker : workers) worker->thread.join();
+	}
+
+	// Not to be called while Process() runs
+	void Reset()
+	{
+		// Let workers finish what they claimed
+		for (auto & worker : workers)
+			for (int s = 0; s <= K; ++s)
+				while ((worker->slots[s].load(std::memory_order_acquire) & 1) == 0 && worker->slots[s].load() >= 0) std::this_thread::yield();
+
+		std::fill(delayLine.begin(), delayLine.end(), 0.0f);
+		std::fill(input.begin(), input.end(), 0.0f);
+		std::fill(bodyOutput.begin(), bodyOutput.end(), 0.0f);
+		position = 0;
+		block = 0;
+
+		for (auto & worker : workers)
+			for (int s = 0; s <= K; ++s) worker->slots[s].store(-1);
+		published.store(-1, std::memory_order_release);
+	}
+
+	virtual void Process(float * samples, uint32_t n) override
+	{
+		while (n)
+		{
+			const uint32_t count = std::min(n, B - position);
+			float * current = input.data() + B;
+			memcpy(current + position, samples, count * sizeof(float));
+
+			// Direct-form head over the previous and the current block
+			for (uint32_t i = 0; i < count; ++i)
+			{
+				const float * x = current + position + i;
+				float acc = 0.0f;
+				for (uint32_t m = 0; m < B; ++m) acc += head[m] * x[-(int) m];
+				samples[i] = acc + bodyOutput[position + i];
+			}
+
+			position += count;
+			samples += count;
+			n -= count;
+
+			if (position == B)
+			{
+				RunBlock();
+				position = 0;
+			}
+		}
+	}
+
+	virtual void SetResonance(float r) override { resonance = r; }
+	virtual void SetCutoff(float c) override { cutoff = c; }
+
+	uint32_t GetBlockSize() const { return B; }
+	size_t GetNumPartitions() const { return P; }
+	uint64_t GetLateTails() const { return lateTails.load(std::memory_order_relaxed); }
+
+private:
+
+	struct Worker
+	{
+		int first = 0, last = 0; // partitions [first, last)
+		std::vector<float> sums; // K + 1 spectra, indexed by target block
+		std::unique_ptr<std::atomic<int64_t>[]> slots; // 2 * target while computing, 2 * target + 1 once done
+		std::thread thread;
+	};
+
+	float * DelaySlot(int64_t index) { return delayLine.data() + (size_t) (index % (int64_t) L) * 2 * bins; }
+
+	// acc += sum over partitions [first, last) of X[target - p] * H[p]
+	void Accumulate(float * acc, int64_t target, int first, int last)
+	{
+		for (int p = first; p < last; ++p)
+		{
+			if (target - p < 0) break;
+			const float * x = DelaySlot(target - p);
+			const float * h = spectra.data() + (size_t) p * 2 * bins;
+			for (size_t k = 0; k < bins; ++k)
+			{
+				const float xr = x[2 * k], xi = x[2 * k + 1];
+				const float hr = h[2 * k], hi = h[2 * k + 1];
+				acc[2 * k] += xr * hr - xi * hi;
+				acc[2 * k + 1] += xr * hi + xi * hr;
+			}
+		}
+	}
+
+	// One worker's tail for target. Only the worker writes its slots. A worker
+	// that lags far enough behind can read delay line spectra that have been
+	// overwritten, but by then the block is past due and the result unused.
+	void Compute(Worker & w, int64_t target)
+	{
+		std::atomic<int64_t> & slot = w.slots[target % (K + 1)];
+		slot.store(2 * target, std::memory_order_release);
+
+		float * sum = w.sums.data() + (size_t) (target % (K + 1)) * 2 * bins;
+		std::fill(sum, sum + 2 * bins, 0.0f);
+		Accumulate(sum, target, w.first, w.last);
+		slot.store(2 * target + 1, std::memory_order_release);
+	}
+
+	void RunBlock()
+	{
+		const int64_t j = block++;
+
+		if (P)
+		{
+			fft.Forward(input.data(), DelaySlot(j));
+			published.store(j, std::memory_order_release);
+
+			std::fill(accumulator.begin(), accumulator.end(), 0.0f);
+			Accumulate(accumulator.data(), j, 0, workers.empty() ? (int) P : K);
+
+			// Workers start at target K. Before that their partitions only
+			// reach back past block 0, so there is no tail to add.
+			for (size_t w = 0; j >= K && w < workers.size(); ++w)
+			{
+				Worker & worker = *workers[w];
+				if (worker.slots[j % (K + 1)].load(std::memory_order_acquire) != 2 * j + 1)
+				{
+					Accumulate(accumulator.data(), j, worker.first, worker.last);
+					lateTails.fetch_add(1, std::memory_order_relaxed);
+					continue;
+				}
+
+				const float * sum = worker.sums.data() + (size_t) (j % (K + 1)) * 2 * bins;
+				for (size_t k = 0; k < 2 * bins; ++k) accumulator[k] += sum[k];
+			}
+
+			// Overlap-save: the second half is the valid part
+			fft.Inverse(accumulator.data(), timeDomain.data());
+			memcpy(bodyOutput.data(), timeDomain.data() + B, B * sizeof(float));
+		}
+
+		memcpy(input.data(), input.data() + B, B * sizeof(float));
+	}
+
+	void Run(Worker & w)
+	{
+		int64_t next = 0;
+
+		while (running.load(std::memory_order_acquire))
+		{
+			const int64_t latest = published.load(std::memory_order_acquire);
+			if (latest + 1 < next) next = 0; // after Reset(), blocks count from 0 again
+
+			// Block latest is being assembled already, so anything up to it is
+			// done inline
+			if (next + K <= latest) next = latest - K + 1;
+
+			if (latest < next)
+			{
+				std::this_thread::sleep_for(pollInterval);
+				continue;
+			}
+
+			// Spectra up to block next are in, which is all the tail for next + K needs
+			Compute(w, next + K);
+			++next;
+		}
+	}
+
+	uint32_t B;
+	RealFFT fft;
+	size_t bins;
+	size_t P = 0; // partitions after the head
+	int K = 1; // first partition handled by the workers
+	size_t L = 0; // delay line length in spectra
+
+	std::vector<float> head;
+	std::vector<float> spectra; // P partition spectra
+	std::vector<float> delayLine; // L input spectra
+	std::vector<float> input; // previous block, then the block being filled
+	std::vector<float> timeDomain;
+	std::vector<float> accumulator;
+	std::vector<float> bodyOutput; // partitioned part for the block being filled
+
+	uint32_t position = 0;
+	int64_t block = 0;
+
+	std::vector<std::unique_ptr<Worker>> workers;
+	std::atomic<int64_t> published { -1 };
+	std::atomic<bool> running { true };
+	std::atomic<uint64_t> lateTails { 0 };
+	std::chrono::duration<double> pollInterval;
+};
+
+#endif
@@ -4,7 +4,9 @@
 #define FILTERS_H
 
 #include <stdint.h>
+#include <algorithm>
 #include <array>
+#include <vector>
 
 #include "Util.h"
 
@@ -50,6 +52,13 @@ public:
 		bCoef = b;
 		aCoef = a;
 	}
+
+	std::array<float, 3> GetBCoefs() const { return bCoef; }
+	std::array<float, 2> GetACoefs() const { return aCoef; }
+
+	// Delay line contents, for splicing separately rendered segments
+	std::array<float, 2> GetState() const { return w; }
+	void SetState(std::array<float, 2> s) { w = s; }
 	
 protected:
 	std::array<float, 3> bCoef; // b0, b1, b2
@@ -254,6 +263,569 @@ private:
 	FilterType t;
 };
 
+/*
+Serial EQ chain of biquad sections for a single channel, with the sections
+spread across SIMD lanes. Each section is a recursion that cannot use more than
+one lane by itself, but the sections of a chain are independent of each other
+within one time step if section k works on sample t - k while section k - 1
+works on sample t - k + 1. So a step runs up to four sections per SSE
+instruction, and each section's output moves one lane up to become the next
+section's input for the following step. Up to eight sections (two vectors) run
+in one pass; longer chains take one pass per group of eight.
+
+The wavefront fills and drains within every Process call through the scalar
+recursion, so there is no added latency and nothing in flight between calls.
+The arithmetic is the same as BiQuadBase::Tick in the same order, so the output
+matches a chain of Tick calls exactly unless the compiler contracts the scalar
+code into fused multiply-adds.
+*/
+
+class BiQuadCascade
+{
+	static const int MAX_LANES = 8;
+
+public:
+
+	BiQuadCascade(size_t numSections = 0) : sections(numSections) {}
+
+	void Resize(size_t numSections) { sections.resize(numSections); }
+	size_t GetNumSections() const { return sections.size(); }
+
+	// Coefficients and state of one section, e.g. set from an RBJFilter with
+	// SetBiquadCoefs(f.GetBCoefs(), f.GetACoefs())
+	BiQuadBase & operator [] (size_t i) { return sections[i]; }
+
+	void Process(float * samples, const uint32_t n)
+	{
+		for (size_t first = 0; first < sections.size(); first += MAX_LANES)
+		{
+			ProcessGroup(samples, n, first, std::min(sections.size() - first, (size_t) MAX_LANES));
+		}
+	}
+
+	void Reset()
+	{
+		for (auto & section : sections) section.SetState({{0.0f, 0.0f}});
+	}
+
+private:
+
+	struct Wavefront
+	{
+		alignas(16) float b0[MAX_LANES], b1[MAX_LANES], b2[MAX_LANES];
+		alignas(16) float a1[MAX_LANES], a2[MAX_LANES];
+		alignas(16) float w0[MAX_LANES], w1[MAX_LANES];
+		alignas(16) float y[MAX_LANES]; // each section's latest output
+		int lanes;
+
+		// Lanes that are not inside the sample range at step t sit out. Later
+		// sections go first so each reads its predecessor's previous output.
+		void Step(float * samples, int64_t n, int64_t t)
+		{
+			const int first = (int) std::max<int64_t>(0, t - n + 1);
+			const int last = (int) std::min<int64_t>(t, lanes - 1);
+			for (int k = last; k >= first; --k)
+			{
+				const float x = k == 0 ? samples[t] : y[k - 1];
+				const float out = b0[k] * x + w0[k];
+				w0[k] = b1[k] * x - a1[k] * out + w1[k];
+				w1[k] = b2[k] * x - a2[k] * out;
+				y[k] = out;
+			}
+			if (last == lanes - 1) samples[t - last] = y[last];
+		}
+	};
+
+#if defined(MOOG_SSE2)
+	// Steps [begin, end), during which every lane has a sample
+	template <int V>
+	static void Run(Wavefront & wf, float * samples, int64_t begin, int64_t end)
+	{
+		__m128 B0[V], B1[V], B2[V], A1[V], A2[V], W0[V], W1[V], Y[V], X[V];
+		for (int v = 0; v < V; ++v)
+		{
+			B0[v] = _mm_load_ps(wf.b0 + 4 * v); B1[v] = _mm_load_ps(wf.b1 + 4 * v); B2[v] = _mm_load_ps(wf.b2 + 4 * v);
+			A1[v] = _mm_load_ps(wf.a1 + 4 * v); A2[v] = _mm_load_ps(wf.a2 + 4 * v);
+			W0[v] = _mm_load_ps(wf.w0 + 4 * v); W1[v] = _mm_load_ps(wf.w1 + 4 * v);
+			Y[v] = _mm_load_ps(wf.y + 4 * v);
+		}
+
+		const int64_t delay = 4 * V - 1;
+		for (int64_t t = begin; t < end; ++t)
+		{
+			// Shift every output one lane up; lane 0 takes the new sample or
+			// the top lane of the vector below
+			X[0] = _mm_move_ss(_mm_shuffle_ps(Y[0], Y[0], _MM_SHUFFLE(2, 1, 0, 0)), _mm_load_ss(samples + t));
+			for (int v = 1; v < V; ++v)
+			{
+				X[v] = _mm_move_ss(_mm_shuffle_ps(Y[v], Y[v], _MM_SHUFFLE(2, 1, 0, 0)), _mm_shuffle_ps(Y[v - 1], Y[v - 1], _MM_SHUFFLE(3, 3, 3, 3)));
+			}
+
+			for (int v = 0; v < V; ++v)
+			{
+				const __m128 out = _mm_add_ps(_mm_mul_ps(B0[v], X[v]), W0[v]);
+				W0[v] = _mm_add_ps(_mm_sub_ps(_mm_mul_ps(B1[v], X[v]), _mm_mul_ps(A1[v], out)), W1[v]);
+				W1[v] = _mm_sub_ps(_mm_mul_ps(B2[v], X[v]), _mm_mul_ps(A2[v], out));
+				Y[v] = out;
+			}
+
+			_mm_store_ss(samples + t - delay, _mm_shuffle_ps(Y[V - 1], Y[V - 1], _MM_SHUFFLE(3, 3, 3, 3)));
+		}
+
+		for (int v = 0; v < V; ++v)
+		{
+			_mm_store_ps(wf.w0 + 4 * v, W0[v]);
+			_mm_store_ps(wf.w1 + 4 * v, W1[v]);
+			_mm_store_ps(wf.y + 4 * v, Y[v]);
+		}
+	}
+#endif
+
+	void ProcessGroup(float * samples, const uint32_t n, size_t first, size_t count)
+	{
+		Wavefront wf;
+
+#if defined(MOOG_SSE2)
+		// Padding lanes pass their input straight through
+		wf.lanes = (int) ((count + 3) & ~3);
+#else
+		wf.lanes = (int) count;
+#endif
+
+		for (int k = 0; k < wf.lanes; ++k)
+		{
+			const bool used = k < (int) count;
+			const std::array<float, 3> b = used ? sections[first + k].GetBCoefs() : std::array<float, 3> {{1.0f, 0.0f, 0.0f}};
+			const std::array<float, 2> a = used ? sections[first + k].GetACoefs() : std::array<float, 2> {{0.0f, 0.0f}};
+			const std::array<float, 2> w = used ? sections[first + k].GetState() : std::array<float, 2> {{0.0f, 0.0f}};
+			wf.b0[k] = b[0]; wf.b1[k] = b[1]; wf.b2[k] = b[2];
+			wf.a1[k] = a[0]; wf.a2[k] = a[1];
+			wf.w0[k] = w[0]; wf.w1[k] = w[1];
+			wf.y[k] = 0.0f;
+		}
+
+		const int64_t steps = (int64_t) n + wf.lanes - 1;
+		int64_t t = 0;
+
+#if defined(MOOG_SSE2)
+		// Fill, run full steps in vectors, drain
+		const int64_t full = (int64_t) n - wf.lanes + 1;
+		if (full > 0)
+		{
+			for (; t < wf.lanes - 1; ++t) wf.Step(samples, n, t);
+			if (wf.lanes == 4) Run<1>(wf, samples, t, t + full);
+			else Run<2>(wf, samples, t, t + full);
+			t += full;
+		}
+#endif
+
+		for (; t < steps; ++t) wf.Step(samples, n, t);
+
+		for (size_t k = 0; k < count; ++k) sections[first + k].SetState({{wf.w0[k], wf.w1[k]}});
+	}
+
+	std::vector<BiQuadBase> sections;
+};
+
+// tan(pi * f) for a normalized frequency f (cutoff / sampleRate), clamped to
+// [0, 0.49]. Taylor polynomials for sin and cos on [0, pi/2] and one divide;
+// relative error within 4e-6 over the whole range.
+inline float moog_tan_prewarp(float f)
+{
+	f = std::min(std::max(f, 0.0f), 0.49f);
+	const float x = (float) MOOG_PI * f;
+	const float x2 = x * x;
+	const float sn = x * (1.0f + x2 * (-1.0f / 6 + x2 * (1.0f / 120 + x2 * (-1.0f / 5040 + x2 * (1.0f / 362880 + x2 * (-1.0f / 39916800))))));
+	const float cs = 1.0f + x2 * (-0.5f + x2 * (1.0f / 24 + x2 * (-1.0f / 720 + x2 * (1.0f / 40320 + x2 * (-1.0f / 3628800 + x2 * (1.0f / 479001600))))));
+	return sn / cs;
+}
+
+#if defined(MOOG_SSE2)
+// Four lanes of moog_tan_prewarp
+inline __m128 moog_tan_prewarp_ps(__m128 f)
+{
+	f = _mm_min_ps(_mm_max_ps(f, _mm_setzero_ps()), _mm_set1_ps(0.49f));
+	const __m128 x = _mm_mul_ps(f, _mm_set1_ps((float) MOOG_PI));
+	const __m128 x2 = _mm_mul_ps(x, x);
+
+	__m128 sn = _mm_set1_ps(-1.0f / 39916800);
+	sn = _mm_add_ps(_mm_mul_ps(sn, x2), _mm_set1_ps(1.0f / 362880));
+	sn = _mm_add_ps(_mm_mul_ps(sn, x2), _mm_set1_ps(-1.0f / 5040));
+	sn = _mm_add_ps(_mm_mul_ps(sn, x2), _mm_set1_ps(1.0f / 120));
+	sn = _mm_add_ps(_mm_mul_ps(sn, x2), _mm_set1_ps(-1.0f / 6));
+	sn = _mm_mul_ps(_mm_add_ps(_mm_mul_ps(sn, x2), _mm_set1_ps(1.0f)), x);
+
+	__m128 cs = _mm_set1_ps(1.0f / 479001600);
+	cs = _mm_add_ps(_mm_mul_ps(cs, x2), _mm_set1_ps(-1.0f / 3628800));
+	cs = _mm_add_ps(_mm_mul_ps(cs, x2), _mm_set1_ps(1.0f / 40320));
+	cs = _mm_add_ps(_mm_mul_ps(cs, x2), _mm_set1_ps(-1.0f / 720));
+	cs = _mm_add_ps(_mm_mul_ps(cs, x2), _mm_set1_ps(1.0f / 24));
+	cs = _mm_add_ps(_mm_mul_ps(cs, x2), _mm_set1_ps(-0.5f));
+	cs = _mm_add_ps(_mm_mul_ps(cs, x2), _mm_set1_ps(1.0f));
+
+	return _mm_div_ps(sn, cs);
+}
+#endif
+
+/*
+Trapezoidal (zero-delay feedback) state-variable filter after Andrew Simper's
+Cytomic SVF. One pass computes the band and low outputs from two integrator
+states; every other response is a fixed mix of input, band and low:
+
+	high  = in - k * band - low
+	notch = in - k * band
+	peak  = 2 * low - in + k * band
+	all   = in - 2 * k * band
+
+The integrator states are the trapezoidal capacitor currents, so the cutoff and
+Q can change on every sample without the state blowing up, unlike the direct
+form biquads. With the polynomial prewarp a new cutoff costs a handful of
+multiplies and two divides.
+*/
+
+struct StateVariableOutputs
+{
+	float low, band, high, notch, peak, all;
+};
+
+class StateVariableFilter
+{
+public:
+
+	enum FilterType
+	{
+		LOWPASS,
+		HIGHPASS,
+		BANDPASS,
+		NOTCH,
+		PEAK,
+		ALLPASS
+	};
+
+	StateVariableFilter(FilterType type = FilterType::LOWPASS, float cutoff = 1000, float sampleRate = 44100) : sampleRate(sampleRate), t(type)
+	{
+		Q = 0.7071f;
+		Reset();
+		SetType(type);
+		SetCutoff(cutoff);
+	}
+
+	void Reset()
+	{
+		ic1eq = 0.0f;
+		ic2eq = 0.0f;
+	}
+
+	// Every response for one input sample
+	StateVariableOutputs Tick(float v0)
+	{
+		float v1, v2;
+		Integrate(v0, v1, v2);
+
+		StateVariableOutputs out;
+		out.low = v2;
+		out.band = v1;
+		out.high = v0 - k * v1 - v2;
+		out.notch = v0 - k * v1;
+		out.peak = 2.0f * v2 - v0 + k * v1;
+		out.all = v0 - 2.0f * k * v1;
+		return out;
+	}
+
+	// In place, with the response selected by SetType
+	void Process(float * samples, uint32_t n)
+	{
+		for (uint32_t s = 0; s < n; ++s)
+		{
+			samples[s] = Step(samples[s]);
+		}
+	}
+
+	// In place, with a new cutoff in Hertz for every sample
+	void Process(float * samples, const float * cutoffs, uint32_t n)
+	{
+		for (uint32_t s = 0; s < n; ++s)
+		{
+			g = moog_tan_prewarp(cutoffs[s] / sampleRate);
+			UpdateCoefficients();
+			samples[s] = Step(samples[s]);
+		}
+		cutoff = n ? cutoffs[n - 1] : cutoff;
+	}
+
+	// In Hertz, 0 to Nyquist
+	void SetCutoff(float c)
+	{
+		cutoff = c;
+		g = moog_tan_prewarp(c / sampleRate);
+		UpdateCoefficients();
+	}
+
+	float GetCutoff() const { return cutoff; }
+
+	// Arbitrary, from 0.01f to ~20
+	void SetQValue(float q)
+	{
+		Q = q < 0.01f ? 0.01f : q;
+		UpdateCoefficients();
+	}
+
+	float GetQValue() const { return Q; }
+
+	void SetType(FilterType newType)
+	{
+		t = newType;
+		UpdateCoefficients();
+	}
+
+	FilterType GetType() const { return t; }
+
+private:
+
+	// Band (v1) and low (v2) outputs, advancing the integrator states
+	inline void Integrate(float v0, float & v1, float & v2)
+	{
+		const float v3 = v0 - ic2eq;
+		v1 = a1 * ic1eq + a2 * v3;
+		v2 = ic2eq + a2 * ic1eq + a3 * v3;
+		ic1eq = 2.0f * v1 - ic1eq;
+		ic2eq = 2.0f * v2 - ic2eq;
+		SNAP_TO_ZERO(ic1eq);
+		SNAP_TO_ZERO(ic2eq);
+	}
+
+	inline float Step(float v0)
+	{
+		float v1, v2;
+		Integrate(v0, v1, v2);
+		return m0 * v0 + m1 * v1 + m2 * v2;
+	}
+
+	void UpdateCoefficients()
+	{
+		k = 1.0f / Q;
+		a1 = 1.0f / (1.0f + g * (g + k));
+		a2 = g * a1;
+		a3 = g * a2;
+
+		// Output = m0 * in + m1 * band + m2 * low
+		switch (t)
+		{
+			case LOWPASS: m0 = 0.0f; m1 = 0.0f; m2 = 1.0f; break;
+			case HIGHPASS: m0 = 1.0f; m1 = -k; m2 = -1.0f; break;
+			case BANDPASS: m0 = 0.0f; m1 = 1.0f; m2 = 0.0f; break;
+			case NOTCH: m0 = 1.0f; m1 = -k; m2 = 0.0f; break;
+			case PEAK: m0 = -1.0f; m1 = k; m2 = 2.0f; break;
+			case ALLPASS: m0 = 1.0f; m1 = -2.0f * k; m2 = 0.0f; break;
+		}
+	}
+
+	float sampleRate;
+	float cutoff;
+	float Q;
+	FilterType t;
+
+	float g = 0.0f, k = 1.0f, a1 = 1.0f, a2 = 0.0f, a3 = 0.0f;
+	float m0 = 0.0f, m1 = 0.0f, m2 = 1.0f;
+	float ic1eq, ic2eq;
+};
+
+/*
+Several StateVariableFilter voices side by side, each with its own cutoff, Q
+and response. Samples (and per-sample cutoffs) are interleaved by voice:
+samples[frame * Voices + voice]. With per-sample cutoffs, the prewarp, the
+coefficient update and the filter step run four voices per SSE instruction;
+any remaining voices take the scalar path.
+*/
+
+template <int Voices>
+class StateVariableFilterBank
+{
+	NO_COPY(StateVariableFilterBank);
+
+public:
+
+	StateVariableFilterBank(float sampleRate) : sampleRate(sampleRate)
+	{
+		for (int v = 0; v < Voices; ++v)
+		{
+			type[v] = StateVariableFilter::LOWPASS;
+			Q[v] = 0.7071f;
+			SetCutoff(v, 1000.0f);
+		}
+		Reset();
+	}
+
+	void Reset()
+	{
+		for (int v = 0; v < Voices; ++v) ic1eq[v] = ic2eq[v] = 0.0f;
+	}
+
+	void Process(float * samples, uint32_t n)
+	{
+		for (uint32_t s = 0; s < n; ++s)
+		{
+			float * frame = samples + s * Voices;
+			for (int v = 0; v < Voices; ++v)
+			{
+				const float v0 = frame[v];
+				const float v3 = v0 - ic2eq[v];
+				const float v1 = a1[v] * ic1eq[v] + a2[v] * v3;
+				const float v2 = ic2eq[v] + a2[v] * ic1eq[v] + a3[v] * v3;
+				ic1eq[v] = 2.0f * v1 - ic1eq[v];
+				ic2eq[v] = 2.0f * v2 - ic2eq[v];
+				frame[v] = m0[v] * v0 + m1[v] * v1 + m2[v] * v2;
+			}
+		}
+		Flush();
+	}
+
+	// cutoffs holds one value in Hertz per voice and sample, interleaved like samples
+	void Process(float * samples, const float * cutoffs, uint32_t n)
+	{
+		const float inverseRate = 1.0f / sampleRate;
+
+		// Local copies of the state, in whole vectors
+		alignas(32) float s1[Voices], s2[Voices], kv[Voices], c0[Voices], c1[Voices], c2[Voices];
+		for (int v = 0; v < Voices; ++v)
+		{
+			s1[v] = ic1eq[v]; s2[v] = ic2eq[v]; kv[v] = k[v];
+			c0[v] = m0[v]; c1[v] = m1[v]; c2[v] = m2[v];
+		}
+
+		for (uint32_t s = 0; s < n; ++s)
+		{
+			float * frame = samples + s * Voices;
+			const float * fc = cutoffs + s * Voices;
+			int v = 0;
+
+#if defined(MOOG_SSE2)
+			const __m128 one = _mm_set1_ps(1.0f);
+			const __m128 two = _mm_set1_ps(2.0f);
+			for (; v + 4 <= Voices; v += 4)
+			{
+				const __m128 gv = moog_tan_prewarp_ps(_mm_mul_ps(_mm_loadu_ps(fc + v), _mm_set1_ps(inverseRate)));
+				const __m128 b1 = _mm_div_ps(one, _mm_add_ps(one, _mm_mul_ps(gv, _mm_add_ps(gv, _mm_load_ps(kv + v)))));
+				const __m128 b2 = _mm_mul_ps(gv, b1);
+				const __m128 b3 = _mm_mul_ps(gv, b2);
+
+				const __m128 x1 = _mm_load_ps(s1 + v);
+				const __m128 x2 = _mm_load_ps(s2 + v);
+				const __m128 v0 = _mm_loadu_ps(frame + v);
+				const __m128 v3 = _mm_sub_ps(v0, x2);
+				const __m128 v1 = _mm_add_ps(_mm_mul_ps(b1, x1), _mm_mul_ps(b2, v3));
+				const __m128 v2 = _mm_add_ps(_mm_add_ps(x2, _mm_mul_ps(b2, x1)), _mm_mul_ps(b3, v3));
+				_mm_store_ps(s1 + v, _mm_sub_ps(_mm_mul_ps(two, v1), x1));
+				_mm_store_ps(s2 + v, _mm_sub_ps(_mm_mul_ps(two, v2), x2));
+
+				const __m128 y = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_load_ps(c0 + v), v0), _mm_mul_ps(_mm_load_ps(c1 + v), v1)), _mm_mul_ps(_mm_load_ps(c2 + v), v2));
+				_mm_storeu_ps(frame + v, y);
+			}
+#endif
+
+			for (; v < Voices; ++v)
+			{
+				const float gv = moog_tan_prewarp(fc[v] * inverseRate);
+				const float b1 = 1.0f / (1.0f + gv * (gv + kv[v]));
+				const float b2 = gv * b1;
+				const float b3 = gv * b2;
+
+				const float v0 = frame[v];
+				const float v3 = v0 - s2[v];
+				const float v1 = b1 * s1[v] + b2 * v3;
+				const float v2 = s2[v] + b2 * s1[v] + b3 * v3;
+				s1[v] = 2.0f * v1 - s1[v];
+				s2[v] = 2.0f * v2 - s2[v];
+
+				// The output mix depends on Q only, not on the cutoff
+				frame[v] = c0[v] * v0 + c1[v] * v1 + c2[v] * v2;
+			}
+		}
+
+		for (int v = 0; v < Voices; ++v)
+		{
+			ic1eq[v] = s1[v];
+			ic2eq[v] = s2[v];
+		}
+		Flush();
+
+		if (n)
+		{
+			for (int v = 0; v < Voices; ++v) SetCutoff(v, cutoffs[(n - 1) * Voices + v]);
+		}
+	}
+
+	void SetCutoff(int voice, float c)
+	{
+		cutoff[voice] = c;
+		g[voice] = moog_tan_prewarp(c / sampleRate);
+		UpdateCoefficients(voice);
+	}
+
+	void SetQValue(int voice, float q)
+	{
+		Q[voice] = q < 0.01f ? 0.01f : q;
+		UpdateCoefficients(voice);
+	}
+
+	void SetType(int voice, StateVariableFilter::FilterType t)
+	{
+		type[voice] = t;
+		UpdateCoefficients(voice);
+	}
+
+	float GetCutoff(int voice) const { return cutoff[voice]; }
+	float GetQValue(int voice) const { return Q[voice]; }
+	StateVariableFilter::FilterType GetType(int voice) const { return type[voice]; }
+
+private:
+
+	// Once per block rather than per sample, to keep the inner loops branch-free
+	void Flush()
+	{
+		for (int v = 0; v < Voices; ++v)
+		{
+			SNAP_TO_ZERO(ic1eq[v]);
+			SNAP_TO_ZERO(ic2eq[v]);
+		}
+	}
+
+	void UpdateCoefficients(int v)
+	{
+		k[v] = 1.0f / Q[v];
+		a1[v] = 1.0f / (1.0f + g[v] * (g[v] + k[v]));
+		a2[v] = g[v] * a1[v];
+		a3[v] = g[v] * a2[v];
+
+		switch (type[v])
+		{
+			case StateVariableFilter::LOWPASS: m0[v] = 0.0f; m1[v] = 0.0f; m2[v] = 1.0f; break;
+			case StateVariableFilter::HIGHPASS: m0[v] = 1.0f; m1[v] = -k[v]; m2[v] = -1.0f; break;
+			case StateVariableFilter::BANDPASS: m0[v] = 0.0f; m1[v] = 1.0f; m2[v] = 0.0f; break;
+			case StateVariableFilter::NOTCH: m0[v] = 1.0f; m1[v] = -k[v]; m2[v] = 0.0f; break;
+			case StateVariableFilter::PEAK: m0[v] = -1.0f; m1[v] = k[v]; m2[v] = 2.0f; break;
+			case StateVariableFilter::ALLPASS: m0[v] = 1.0f; m1[v] = -2.0f * k[v]; m2[v] = 0.0f; break;
+		}
+	}
+
+	alignas(32) float ic1eq[Voices];
+	alignas(32) float ic2eq[Voices];
+
+	alignas(32) float g[Voices];
+	alignas(32) float k[Voices];
+	alignas(32) float a1[Voices];
+	alignas(32) float a2[Voices];
+	alignas(32) float a3[Voices];
+	alignas(32) float m0[Voices];
+	alignas(32) float m1[Voices];
+	alignas(32) float m2[Voices];
+
+	float cutoff[Voices];
+	float Q[Voices];
+	StateVariableFilter::FilterType type[Voices];
+	float sampleRate;
+};
+
 // +/-0.05dB above 9.2Hz @ 44,100Hz
 class PinkingFilter
 {
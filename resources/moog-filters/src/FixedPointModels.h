@@ -0,0 +1,250 @@
+#pragma once
+
+#ifndef FIXED_POINT_MODELS_H
+#define FIXED_POINT_MODELS_H
+
+#include "StilsonModel.h"
+
+/*
+Fixed-point versions of the Stilson and MusicDSP models for integer-only DSP
+cores. Samples are Q31 (or Q15 through the int16_t overloads). State and
+coefficients are held in int32_t Q formats chosen for each model's signal range,
+products go through int64_t, and every store saturates, so the kernels never
+touch the FPU. Coefficients are still derived in floating point by SetCutoff and
+SetResonance, which are expected to run outside the audio loop.
+
+Stilson: signals are clamped to +/-0.95 by moog_saturate, so state lives in Q31
+and the clamp becomes a saturating compare. p and the resonance gain can exceed
+1.0 in magnitude and are kept in Q30.
+
+MusicDSP: the feedback path can reach roughly 4x the input, so signals are kept
+in Q27 (+/-16) and coefficients in Q28.
+*/
+
+inline int32_t moog_sat32(int64_t x)
+{
+	return (int32_t) (x > INT32_MAX ? INT32_MAX : (x < INT32_MIN ? INT32_MIN : x));
+}
+
+inline int32_t moog_clamp32(int64_t x, int32_t limit)
+{
+	return (int32_t) (x > limit ? limit : (x < -limit ? -limit : x));
+}
+
+// Multiplies two fixed-point values and drops `shift` fractional bits with rounding
+inline int64_t moog_mul_q(int64_t a, int64_t b, int shift)
+{
+	return (a * b + (1LL << (shift - 1))) >> shift;
+}
+
+inline int32_t moog_to_q(double x, int fractionalBits)
+{
+	return moog_sat32((int64_t) llround(x * (double) (1LL << fractionalBits)));
+}
+
+class StilsonMoogFixed
+{
+	static const uint32_t SCRATCH_SIZE = 256;
+
+public:
+
+	StilsonMoogFixed(float sampleRate) : sampleRate(sampleRate)
+	{
+		memset(state, 0, sizeof(state));
+		output = 0;
+		resonance = 0.0f;
+		SetCutoff(1000.0f);
+		SetResonance(0.10f);
+	}
+
+	// Q31 in place
+	void Process(int32_t * samples, uint32_t n)
+	{
+		static const int32_t inputScale = moog_to_q(0.65, 31);
+		static const int32_t limit = moog_to_q(0.95, 31);
+
+		for (int s = 0; s < n; ++s)
+		{
+			const int64_t input = moog_mul_q(samples[s], inputScale, 31);
+
+			// Negative Feedback
+			int64_t out = (input - output) >> 2;
+
+			for (int pole = 0; pole < 4; ++pole)
+			{
+				const int64_t localState = state[pole];
+				out = moog_clamp32(out + moog_mul_q(p, out - localState, 30), limit);
+				state[pole] = (int32_t) out;
+				out = moog_clamp32(out + localState, limit);
+			}
+
+			samples[s] = (int32_t) out;
+			output = moog_clamp32(moog_mul_q(out, Q, 30), INT32_MAX); // Scale stateful output by Q
+		}
+	}
+
+	// Q15 in place, converted through the Q31 scratch buffer in blocks
+	void Process(int16_t * samples, uint32_t n)
+	{
+		for (uint32_t offset = 0; offset < n; offset += SCRATCH_SIZE)
+		{
+			const uint32_t count = n - offset < SCRATCH_SIZE ? n - offset : SCRATCH_SIZE;
+			int16_t * block = samples + offset;
+			for (uint32_t s = 0; s < count; ++s) scratch[s] = (int32_t) block[s] << 16;
+			Process(scratch, count);
+			for (uint32_t s = 0; s < count; ++s) block[s] = (int16_t) moog_clamp32(((int64_t) scratch[s] + (1 << 15)) >> 16, 32767);
+		}
+	}
+
+	void SetResonance(float r)
+	{
+		r = moog_min(r, 1);
+		resonance = r;
+
+		double ix = pf * 99;
+		int ixint = floor(ix);
+		double ixfrac = ix - ixint;
+
+		Q = moog_to_q(r * moog_lerp(ixfrac, S_STILSON_GAINTABLE[ixint + 99], S_STILSON_GAINTABLE[ixint + 100]), 30);
+	}
+
+	void SetCutoff(float c)
+	{
+		cutoff = c;
+
+		double fc = cutoff / sampleRate;
+		double x2 = fc * fc;
+		double x3 = fc * fc * fc;
+
+		// Frequency & amplitude correction (Cubic Fit)
+		pf = -0.69346 * x3 - 0.59515 * x2 + 3.2937 * fc - 1.0072;
+		p = moog_to_q(pf, 30);
+
+		SetResonance(resonance);
+	}
+
+	float GetResonance() const { return resonance; }
+	float GetCutoff() const { return cutoff; }
+
+private:
+
+	int32_t state[4]; // Q31
+	int32_t output; // Q31
+	int32_t p; // Q30
+	int32_t Q; // Q30
+
+	int32_t scratch[SCRATCH_SIZE]; // Q31, for the Q15 overload
+
+	double pf;
+	float cutoff;
+	float resonance;
+	float sampleRate;
+};
+
+class MusicDSPMoogFixed
+{
+	static const int SIGNAL_BITS = 27;
+	static const int COEF_BITS = 28;
+	static const uint32_t SCRATCH_SIZE = 256;
+
+public:
+
+	MusicDSPMoogFixed(float sampleRate) : sampleRate(sampleRate)
+	{
+		memset(stage, 0, sizeof(stage));
+		memset(delay, 0, sizeof(delay));
+		resonance = 0.0f;
+		SetCutoff(1000.0f);
+		SetResonance(0.10f);
+	}
+
+	// Q31 in place
+	void Process(int32_t * samples, uint32_t n)
+	{
+		static const int32_t sixth = moog_to_q(1.0 / 6.0, 31);
+		const int shift = 31 - SIGNAL_BITS;
+
+		int64_t s0 = stage[0], s1 = stage[1], s2 = stage[2], s3 = stage[3];
+		int64_t d0 = delay[0], d1 = delay[1], d2 = delay[2], d3 = delay[3];
+
+		for (int s = 0; s < n; ++s)
+		{
+			const int64_t x = moog_sat32((samples[s] >> shift) - moog_mul_q(feedback, s3, COEF_BITS));
+
+			// Four cascaded one-pole filters (bilinear transform)
+			s0 = moog_sat32(moog_mul_q(x + d0, p, COEF_BITS) - moog_mul_q(k, s0, COEF_BITS));
+			d0 = x;
+			s1 = moog_sat32(moog_mul_q(s0 + d1, p, COEF_BITS) - moog_mul_q(k, s1, COEF_BITS));
+			d1 = s0;
+			s2 = moog_sat32(moog_mul_q(s1 + d2, p, COEF_BITS) - moog_mul_q(k, s2, COEF_BITS));
+			d2 = s1;
+			s3 = moog_sat32(moog_mul_q(s2 + d3, p, COEF_BITS) - moog_mul_q(k, s3, COEF_BITS));
+			d3 = s2;
+
+			// Clipping band-limited sigmoid
+			const int64_t cube = moog_mul_q(moog_mul_q(s3, s3, SIGNAL_BITS), s3, SIGNAL_BITS);
+			s3 = moog_sat32(s3 - moog_mul_q(cube, sixth, 31));
+
+			samples[s] = moog_sat32(s3 << shift);
+		}
+
+		stage[0] = (int32_t) s0; stage[1] = (int32_t) s1; stage[2] = (int32_t) s2; stage[3] = (int32_t) s3;
+		delay[0] = (int32_t) d0; delay[1] = (int32_t) d1; delay[2] = (int32_t) d2; delay[3] = (int32_t) d3;
+	}
+
+	// Q15 in place, converted through the Q31 scratch buffer in blocks
+	void Process(int16_t * samples, uint32_t n)
+	{
+		for (uint32_t offset = 0; offset < n; offset += SCRATCH_SIZE)
+		{
+			const uint32_t count = n - offset < SCRATCH_SIZE ? n - offset : SCRATCH_SIZE;
+			int16_t * block = samples + offset;
+			for (uint32_t s = 0; s < count; ++s) scratch[s] = (int32_t) block[s] << 16;
+			Process(scratch, count);
+			for (uint32_t s = 0; s < count; ++s) block[s] = (int16_t) moog_clamp32(((int64_t) scratch[s] + (1 << 15)) >> 16, 32767);
+		}
+	}
+
+	void SetResonance(float r)
+	{
+		resonance = r;
+		feedback = moog_to_q(r * resonanceScale, COEF_BITS);
+	}
+
+	void SetCutoff(float c)
+	{
+		cutoff = c;
+		fc = 2.0 * c / sampleRate;
+
+		double pf = fc * (1.8 - 0.8 * fc);
+		double kf = 2.0 * sin(fc * MOOG_PI * 0.5) - 1.0;
+		double t1 = (1.0 - pf) * 1.386249;
+		double t2 = 12.0 + t1 * t1;
+		resonanceScale = (t2 + 6.0 * t1) / (t2 - 6.0 * t1);
+
+		p = moog_to_q(pf, COEF_BITS);
+		k = moog_to_q(kf, COEF_BITS);
+
+		SetResonance(resonance);
+	}
+
+	float GetResonance() const { return resonance; }
+	float GetCutoff() const { return cutoff; }
+
+private:
+
+	int32_t stage[4]; // Q27
+	int32_t delay[4]; // Q27
+	int32_t p; // Q28
+	int32_t k; // Q28
+	int32_t feedback; // Q28
+	int32_t scratch[SCRATCH_SIZE]; // Q31, for the Q15 overload
+
+	double resonanceScale;
+	double fc; // relative to Nyquist
+	float cutoff;
+	float resonance;
+	float sampleRate;
+};
+
+#endif
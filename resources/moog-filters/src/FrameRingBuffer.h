@@ -0,0 +1,198 @@
+#pragma once
+
+#ifndef FRAME_RING_BUFFER_H
+#define FRAME_RING_BUFFER_H
+
+#include "Util.h"
+
+#include <algorithm>
+#include <atomic>
+#include <stdexcept>
+#include <type_traits>
+#include <vector>
+#include <stdint.h>
+#include <string.h>
+
+/*
+Single-producer/single-consumer ring of planar multichannel blocks. A slot
+holds up to blockFrames frames for every channel, stored channel after channel,
+together with the frame count and the sample time of its first frame.
+
+Filters render straight into a slot through beginWrite()/endWrite(), so planar
+output reaches the consumer without being interleaved on the way in. The
+consumer sees whole blocks through peek()/pop(), and comparing each timestamp
+with the end of the previous block shows gaps and overlaps exactly, with no
+need to count samples.
+
+Slots are published with the same acquire/release protocol as RingBufferT, on
+free-running block indices masked to a power-of-two slot count. Each channel
+of each slot starts on a 64-byte boundary.
+*/
+
+template <typename T>
+struct FrameBlockT
+{
+	const T * const * channels = nullptr; // one pointer per channel
+	uint32_t frames = 0;
+	int64_t sampleTime = 0; // of the first frame
+};
+
+template <typename T>
+class FrameRingBufferT
+{
+	static_assert(std::is_trivially_copyable<T>::value, "Ring elements are copied with memcpy");
+
+	NO_COPY(FrameRingBufferT);
+
+public:
+
+	FrameRingBufferT() : writeIndex(0), readIndex(0) {}
+
+	FrameRingBufferT(int numChannels, uint32_t blockFrames, size_t numBlocks) : writeIndex(0), readIndex(0)
+	{
+		resize(numChannels, blockFrames, numBlocks);
+	}
+
+	// At least numBlocks slots. Resets both indices, so it must be
+	// synchronized with the read and write threads.
+	void resize(int numChannels, uint32_t blockFrames, size_t numBlocks)
+	{
+		if (numChannels < 1 || blockFrames < 1) throw std::runtime_error("frame ring needs at least one channel and one frame");
+
+		size_t slots = 1;
+		while (slots < numBlocks) slots <<= 1;
+
+		const size_t align = 64 / sizeof(T) > 0 ? 64 / sizeof(T) : 1;
+		stride = (blockFrames + align - 1) / align * align;
+
+		this->numChannels = numChannels;
+		this->blockFrames = blockFrames;
+		capacity = slots;
+		mask = slots - 1;
+
+		// Zero-filled, which also faults every page in before the audio thread gets to it
+		storage.assign(slots * numChannels * stride + align, T());
+		T * base = storage.data();
+		while (((uintptr_t) base) & 63) ++base;
+
+		pointers.resize(slots * numChannels);
+		for (size_t s = 0; s < slots; ++s)
+			for (int c = 0; c < numChannels; ++c)
+				pointers[s * numChannels + c] = base + (s * numChannels + c) * stride;
+
+		frames.assign(slots, 0);
+		times.assign(slots, 0);
+
+		clear();
+	}
+
+	void clear()
+	{
+		writeIndex.store(0);
+		readIndex.store(0);
+	}
+
+	int getNumChannels() const { return numChannels; }
+	uint32_t getBlockFrames() const { return blockFrames; }
+	size_t getNumBlocks() const { return capacity; }
+
+	// Free slots. Only safe to call from the write thread.
+	size_t getAvailableWrite() const
+	{
+		return capacity - (writeIndex.load(std::memory_order_relaxed) - readIndex.load(std::memory_order_acquire));
+	}
+
+	// Filled slots. Only safe to call from the read thread.
+	size_t getAvailableRead() const
+	{
+		return writeIndex.load(std::memory_order_acquire) - readIndex.load(std::memory_order_relaxed);
+	}
+
+	// Channel pointers of the next free slot, each blockFrames long, or null
+	// when the ring is full. Only safe to call from the write thread.
+	T * const * beginWrite()
+	{
+		if (!getAvailableWrite()) return nullptr;
+		return pointers.data() + (writeIndex.load(std::memory_order_relaxed) & mask) * numChannels;
+	}
+
+	// Publishes the slot returned by beginWrite()
+	void endWrite(uint32_t count, int64_t sampleTime)
+	{
+		const size_t w = writeIndex.load(std::memory_order_relaxed);
+		frames[w & mask] = std::min(count, blockFrames);
+		times[w & mask] = sampleTime;
+		writeIndex.store(w + 1, std::memory_order_release);
+	}
+
+	// Copies count (at most blockFrames) planar frames into one slot
+	bool write(const T * const * channels, uint32_t count, int64_t sampleTime)
+	{
+		T * const * slot = beginWrite();
+		if (!slot) return false;
+
+		count = std::min(count, blockFrames);
+		for (int c = 0; c < numChannels; ++c) memcpy(slot[c], channels[c], count * sizeof(T));
+		endWrite(count, sampleTime);
+		return true;
+	}
+
+	// Splits count (at most blockFrames) interleaved frames into one slot
+	bool writeInterleaved(const T * in, uint32_t count, int64_t sampleTime)
+	{
+		T * const * slot = beginWrite();
+		if (!slot) return false;
+
+		count = std::min(count, blockFrames);
+		for (int c = 0; c < numChannels; ++c)
+		{
+			const T * src = in + c;
+			T * dst = slot[c];
+			for (uint32_t f = 0; f < count; ++f) dst[f] = src[f * numChannels];
+		}
+		endWrite(count, sampleTime);
+		return true;
+	}
+
+	// The oldest filled slot. Only safe to call from the read thread.
+	bool peek(FrameBlockT<T> & block) const
+	{
+		if (!getAvailableRead()) return false;
+
+		const size_t i = readIndex.load(std::memory_order_relaxed) & mask;
+		block.channels = pointers.data() + i * numChannels;
+		block.frames = frames[i];
+		block.sampleTime = times[i];
+		return true;
+	}
+
+	// Releases the slot returned by peek()
+	void pop()
+	{
+		readIndex.store(readIndex.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+	}
+
+private:
+
+	int numChannels = 0;
+	uint32_t blockFrames = 0;
+	size_t stride = 0;
+	size_t capacity = 0;
+	size_t mask = 0;
+
+	std::vector<T> storage;
+	std::vector<T *> pointers; // numChannels per slot
+	std::vector<uint32_t> frames;
+	std::vector<int64_t> times;
+
+	char padding0[64];
+	std::atomic<size_t> writeIndex;
+	char padding1[64];
+	std::atomic<size_t> readIndex;
+	char padding2[64];
+};
+
+typedef FrameBlockT<float> FrameBlock;
+typedef FrameRingBufferT<float> FrameRingBuffer;
+
+#endif
@@ -0,0 +1,197 @@
+#pragma once
+
+#ifndef HALF_BAND_DESIGN_H
+#define HALF_BAND_DESIGN_H
+
+#include "Util.h"
+
+#include <vector>
+#include <math.h>
+
+/*
+Design of the 2x anti-imaging and anti-aliasing filters used by Oversampler,
+from a stopband attenuation and a transition width. Widths are fractions of
+the oversampled rate, centered on its quarter: a width of 0.1 passes up to
+0.2 and stops from 0.3.
+
+Linear phase: a half-band lowpass FIR, windowed sinc with a Kaiser window whose
+beta and length follow Kaiser's formulas. Every other tap is zero and the center
+tap is 0.5, so only the `taps` nonzero taps of the odd branch are returned.
+
+Minimum phase: a polyphase IIR half-band made of two parallel chains of
+first-order allpass sections in z^-2 (Valenzuela and Constantinides; the
+elliptic design as in Laurent de Soras' HIIR). Coefficients alternate between
+the two chains. A handful of coefficients reaches the attenuation of a long
+FIR at a fraction of the cost, at the price of phase distortion near the band
+edge.
+
+Designs are done in double precision once, at startup.
+*/
+
+// Zeroth-order modified Bessel function of the first kind
+inline double moog_bessel_i0(double x)
+{
+	double sum = 1.0, term = 1.0;
+	for (int k = 1; k < 64 && term > 1e-12 * sum; ++k)
+	{
+		term *= (x / (2.0 * k)) * (x / (2.0 * k));
+		sum += term;
+	}
+	return sum;
+}
+
+inline double moog_kaiser_beta(double attenuationDb)
+{
+	if (attenuationDb > 50.0) return 0.1102 * (attenuationDb - 8.7);
+	if (attenuationDb >= 21.0) return 0.5842 * pow(attenuationDb - 21.0, 0.4) + 0.07886 * (attenuationDb - 21.0);
+	return 0.0;
+}
+
+// Nonzero taps needed for a spec, rounded up to an even number
+inline int moog_halfband_fir_taps(double transition, double attenuationDb)
+{
+	const double length = (attenuationDb - 7.95) / (14.36 * transition) + 1.0;
+	int taps = (int) ceil((length + 1.0) / 2.0);
+	return taps + (taps & 1);
+}
+
+// Odd-branch taps of a half-band FIR with 2 * taps - 1 points and unity DC
+// gain. taps must be even.
+inline std::vector<float> moog_design_halfband_fir(int taps, double attenuationDb)
+{
+	const int length = 2 * taps - 1;
+	const double center = (length - 1) / 2.0;
+	const double beta = moog_kaiser_beta(attenuationDb);
+	const double norm = moog_bessel_i0(beta);
+
+	std::vector<double> h(taps);
+	double sum = 0.0;
+	for (int i = 0; i < taps; ++i)
+	{
+		const double n = 2.0 * i;
+		const double x = 0.5 * (n - center);
+		const double r = (n - center) / (center + 1.0);
+		h[i] = 0.5 * sin(MOOG_PI * x) / (MOOG_PI * x) * moog_bessel_i0(beta * sqrt(1.0 - r * r)) / norm;
+		sum += h[i];
+	}
+
+	// Center tap is 0.5, so the odd branch has to sum to 0.5 as well
+	std::vector<float> coefs(taps);
+	for (int i = 0; i < taps; ++i) coefs[i] = (float) (h[i] * 0.5 / sum);
+	return coefs;
+}
+
+// Elliptic parameters k and q of the transition band
+inline void moog_halfband_iir_transition(double transition, double & k, double & q)
+{
+	k = tan((1.0 - transition * 2.0) * MOOG_PI / 4.0);
+	k *= k;
+	const double kksqrt = pow(1.0 - k * k, 0.25);
+	const double e = 0.5 * (1.0 - kksqrt) / (1.0 + kksqrt);
+	const double e4 = e * e * e * e;
+	q = e * (1.0 + e4 * (2.0 + e4 * (15.0 + 150.0 * e4)));
+}
+
+// Allpass coefficients needed for a spec
+inline int moog_halfband_iir_coefs(double transition, double attenuationDb)
+{
+	double k, q;
+	moog_halfband_iir_transition(transition, k, q);
+
+	const double p = pow(10.0, -attenuationDb / 10.0);
+	const double a = p / (1.0 - p);
+	int order = (int) ceil(log(a * a / 16.0) / log(q));
+	if ((order & 1) == 0) ++order;
+	if (order < 3) order = 3;
+	return (order - 1) / 2;
+}
+
+// Stopband attenuation reached by numCoefs coefficients
+inline double moog_halfband_iir_attenuation(int numCoefs, double transition)
+{
+	double k, q;
+	moog_halfband_iir_transition(transition, k, q);
+
+	const int order = 2 * numCoefs + 1;
+	const double a = 4.0 * exp(order * 0.5 * log(q));
+	return -10.0 * log10(a / (1.0 + a));
+}
+
+inline std::vector<double> moog_design_halfband_iir(int numCoefs, double transition)
+{
+	double k, q;
+	moog_halfband_iir_transition(transition, k, q);
+
+	const int order = 2 * numCoefs + 1;
+	std::vector<double> coefs(numCoefs);
+
+	for (int index = 0; index < numCoefs; ++index)
+	{
+		const int c = index + 1;
+
+		// Theta function series, truncated once the terms vanish
+		double num = 0.0, den = 0.0, term = 0.0, sign = 1.0;
+		for (int i = 0; i == 0 || fabs(term) > 1e-100; ++i, sign = -sign)
+		{
+			term = pow(q, i * (i + 1)) * sin((2 * i + 1) * c * MOOG_PI / order) * sign;
+			num += term;
+		}
+		sign = -1.0;
+		for (int i = 1; i == 1 || fabs(term) > 1e-100; ++i, sign = -sign)
+		{
+			term = pow(q, i * i) * cos(2 * i * c * MOOG_PI / order) * sign;
+			den += term;
+		}
+
+		const double ww = num * pow(q, 0.25) / (den + 0.5);
+		const double wwsq = ww * ww;
+		const double x = sqrt((1.0 - wwsq * k) * (1.0 - wwsq / k)) / (1.0 + wwsq);
+		coefs[index] = (1.0 - x) / (1.0 + x);
+	}
+
+	return coefs;
+}
+
+// acc[v] = sum of h[i] * x[i * Lanes + v] over the taps, for every lane. Used by
+// the polyphase half-band stages on their nonzero branch only.
+template <int Lanes>
+inline void moog_halfband_dot(const float * h, const float * x, int taps, float * acc)
+{
+#if defined(MOOG_SSE2)
+	if (Lanes == 1)
+	{
+		__m128 a = _mm_setzero_ps();
+		__m128 b = _mm_setzero_ps();
+		int i = 0;
+		for (; i + 8 <= taps; i += 8)
+		{
+			a = _mm_add_ps(a, _mm_mul_ps(_mm_loadu_ps(h + i), _mm_loadu_ps(x + i)));
+			b = _mm_add_ps(b, _mm_mul_ps(_mm_loadu_ps(h + i + 4), _mm_loadu_ps(x + i + 4)));
+		}
+		a = _mm_add_ps(a, b);
+		a = _mm_add_ps(a, _mm_movehl_ps(a, a));
+		a = _mm_add_ss(a, _mm_shuffle_ps(a, a, 1));
+		float sum = _mm_cvtss_f32(a);
+		for (; i < taps; ++i) sum += h[i] * x[i];
+		acc[0] = sum;
+		return;
+	}
+
+	if ((Lanes % 4) == 0)
+	{
+		for (int v = 0; v < Lanes; v += 4)
+		{
+			__m128 a = _mm_setzero_ps();
+			for (int i = 0; i < taps; ++i) a = _mm_add_ps(a, _mm_mul_ps(_mm_set1_ps(h[i]), _mm_loadu_ps(x + i * Lanes + v)));
+			_mm_storeu_ps(acc + v, a);
+		}
+		return;
+	}
+#endif
+
+	for (int v = 0; v < Lanes; ++v) acc[v] = 0.0f;
+	for (int i = 0; i < taps; ++i)
+		for (int v = 0; v < Lanes; ++v) acc[v] += h[i] * x[i * Lanes + v];
+}
+
+#endif
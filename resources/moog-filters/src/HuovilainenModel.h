@@ -6,7 +6,11 @@
 #ifndef HUOVILAINEN_LADDER_H
 #define HUOVILAINEN_LADDER_H
 
+#include "CoefficientCache.h"
 #include "LadderFilterBase.h"
+#include "Oversampler.h"
+
+#include <string.h>
 
 /*
 Huovilainen developed an improved and physically correct model of the Moog
@@ -25,87 +29,316 @@ phase compensation at the final stage of the filter.
 References: Huovilainen (2004), Huovilainen (2010), DAFX - Zolzer (ed) (2nd ed)
 Original implementation: Victor Lazzarini for CSound5
 
+The oversampling factor is a template parameter (1, 2, 4 or 8). The input is
+interpolated and the output decimated with half-band filters, see Oversampler.h.
+HuovilainenMoog is the 2x version. The resampler history is part of the
+state, which therefore has a constructor but still holds no pointers.
+
 Considerations for oversampling: 
 http://music.columbia.edu/pipermail/music-dsp/2005-February/062778.html
 http://www.synthmaker.co.uk/dokuwiki/doku.php?id=tutorials:oversampling
 */ 
 
-class HuovilainenMoog : public LadderFilterBase
+template <int Oversampling>
+struct HuovilainenCoeffsT
 {
-public:
+	void SetCutoff(float sampleRate, float c)
+	{
+		cutoff = c;
+
+		double fc =  cutoff / sampleRate;
+		double f  =  fc / Oversampling;
+		double fc2 = fc * fc;
+		double fc3 = fc * fc * fc;
+
+		double fcr = 1.8730 * fc3 + 0.4955 * fc2 - 0.6490 * fc + 0.9988;
+		acr = -3.9364 * fc2 + 1.8409 * fc + 0.9968;
+
+		// Equivalent to (1 - exp(...)) / thermal on unscaled state
+		tune = 1.0 - exp(-((2 * MOOG_PI) * f * fcr));
+
+		SetResonance(resonance);
+	}
 	
-	HuovilainenMoog(float sampleRate) : LadderFilterBase(sampleRate), thermal(0.000025)
+	void SetResonance(float r)
+	{
+		resonance = r;
+		resQuad = 4.0 * resonance * acr;
+	}
+	
+	float cutoff;
+	float resonance;
+	double tune;
+	double acr;
+	double resQuad;
+};
+
+template <int Oversampling>
+struct HuovilainenStateT
+{
+	void Init()
 	{
 		memset(stage, 0, sizeof(stage));
 		memset(delay, 0, sizeof(delay));
 		memset(stageTanh, 0, sizeof(stageTanh));
-		SetCutoff(1000.0f);
-		SetResonance(0.10f);
+		thermal = 0.000025;
+		thermalInv = 1.0 / thermal;
+		outputMode = LadderFilterBase::LP4;
+		oversampler.Reset();
 	}
 	
-	virtual ~HuovilainenMoog()
+	// tune does not depend on thermal in the scaled formulation, so a thermal
+	// change only rescales the state and refreshes its cached tanh. value must
+	// be positive.
+	void SetThermal(double value)
 	{
+		const double ratio = value / thermal;
+		for (int k = 0; k < 4; ++k)
+		{
+			stage[k] *= ratio;
+			stageTanh[k] = tanh(stage[k]);
+		}
+		for (int k = 0; k < 3; ++k) delay[k] *= ratio;
 		
+		thermal = value;
+		thermalInv = 1.0 / thermal;
 	}
 	
-	virtual void Process(float * samples, uint32_t n) override
+	double stage[4]; // scaled by thermal
+	double stageTanh[4];
+	double delay[3]; // last stage[3], the half-sample delayed output and the last mixed output, scaled by thermal
+
+	double thermal;
+	double thermalInv;
+	LadderFilterBase::OutputMode outputMode;
+
+	Oversampler<Oversampling> oversampler;
+};
+
+// The ladder runs on thermal-scaled state (stage[k] * thermal in the original
+// formulation), so tanh is applied directly to the state and the 1 / thermal
+// inside tune cancels out. stageTanh[k] always holds tanh(stage[k]) from the
+// previous step, which leaves one tanh for the input and one per stage.
+template <int Oversampling>
+inline void moog_process(const HuovilainenCoeffsT<Oversampling> & c, HuovilainenStateT<Oversampling> & st, float * samples, uint32_t n)
+{
+	const double tune = c.tune;
+	const double resQuad = c.resQuad;
+	const double thermal = st.thermal;
+	const double thermalInv = st.thermalInv;
+	const bool lp4 = st.outputMode == LadderFilterBase::LP4;
+	
+	double outputMix[LadderFilterBase::NUM_TAPS];
+	LadderFilterBase::GetOutputModeWeights(st.outputMode, outputMix);
+	
+	double s0 = st.stage[0], s1 = st.stage[1], s2 = st.stage[2], s3 = st.stage[3];
+	double t0 = st.stageTanh[0], t1 = st.stageTanh[1], t2 = st.stageTanh[2], t3 = st.stageTanh[3];
+	double last = st.delay[0], out = st.delay[1];
+	double lastMix = st.delay[2];
+
+	for (int s = 0; s < n; ++s)
 	{
-		for (int s = 0; s < n; ++s)
+		float input[Oversampling];
+		float output[Oversampling];
+
+		st.oversampler.Upsample(&samples[s], input);
+
+		for (int j = 0; j < Oversampling; j++) 
 		{
-			// Oversample
-			for (int j = 0; j < 2; j++) 
+			const double u = input[j] * thermal - resQuad * out;
+
+			s0 += tune * (tanh(u) - t0);
+			t0 = tanh(s0);
+			s1 += tune * (t0 - t1);
+			t1 = tanh(s1);
+			s2 += tune * (t1 - t2);
+			t2 = tanh(s2);
+			s3 += tune * (t2 - t3);
+			t3 = tanh(s3);
+
+			// 0.5 sample delay for phase compensation
+			out = (s3 + last) * 0.5;
+			last = s3;
+
+			if (lp4)
+			{
+				output[j] = out * thermalInv;
+			}
+			else
 			{
-				float input = samples[s] - resQuad * delay[5];
-				delay[0] = stage[0] = delay[0] + tune * (tanh(input * thermal) - stageTanh[0]);
-				for (int k = 1; k < 4; k++) 
-				{
-					input = stage[k-1];
-					stage[k] = delay[k] + tune * ((stageTanh[k-1] = tanh(input * thermal)) - (k != 3 ? stageTanh[k] : tanh(delay[k] * thermal)));
-					delay[k] = stage[k];
-				}
-				// 0.5 sample delay for phase compensation
-				delay[5] = (stage[3] + delay[4]) * 0.5;
-				delay[4] = stage[3];
+				// Mixed responses get the same half-sample delay as the lowpass
+				const double mix = outputMix[0] * u + outputMix[1] * s0 + outputMix[2] * s1 + outputMix[3] * s2 + outputMix[4] * s3;
+				output[j] = (mix + lastMix) * 0.5 * thermalInv;
+				lastMix = mix;
 			}
-			samples[s] = delay[5];
 		}
 
+		st.oversampler.Downsample(output, &samples[s]);
 	}
-	
-	virtual void SetResonance(float r) override
+
+	st.stage[0] = s0; st.stage[1] = s1; st.stage[2] = s2; st.stage[3] = s3;
+	st.stageTanh[0] = t0; st.stageTanh[1] = t1; st.stageTanh[2] = t2; st.stageTanh[3] = t3;
+	st.delay[0] = last; st.delay[1] = out; st.delay[2] = lastMix;
+}
+
+/*
+The formulation moog_process replaced, kept as a reference for checking it:
+unscaled state, tanh(x * thermal) evaluated for every stage on every step,
+tune divided by thermal and the feedback input truncated to float. Runs
+around the same oversampler and output mixing, so the two differ only in the
+ladder arithmetic.
+*/
+
+template <int Oversampling>
+struct HuovilainenReferenceStateT
+{
+	void Init()
 	{
-		resonance = r;
-		resQuad = 4.0 * resonance * acr;
+		memset(stage, 0, sizeof(stage));
+		memset(delay, 0, sizeof(delay));
+		memset(stageTanh, 0, sizeof(stageTanh));
+		lastMix = 0.0;
+		thermal = 0.000025;
+		outputMode = LadderFilterBase::LP4;
+		oversampler.Reset();
 	}
-	
-	virtual void SetCutoff(float c) override
+
+	double stage[4];
+	double stageTanh[3];
+	double delay[6];
+	double lastMix;
+
+	double thermal;
+	LadderFilterBase::OutputMode outputMode;
+
+	Oversampler<Oversampling> oversampler;
+};
+
+template <int Oversampling>
+inline void moog_process_reference(const HuovilainenCoeffsT<Oversampling> & c, HuovilainenReferenceStateT<Oversampling> & st, float * samples, uint32_t n)
+{
+	double * stage = st.stage;
+	double * stageTanh = st.stageTanh;
+	double * delay = st.delay;
+	const double thermal = st.thermal;
+	const double tune = c.tune / thermal;
+	const double resQuad = c.resQuad;
+	const bool lp4 = st.outputMode == LadderFilterBase::LP4;
+
+	double outputMix[LadderFilterBase::NUM_TAPS];
+	LadderFilterBase::GetOutputModeWeights(st.outputMode, outputMix);
+
+	for (int s = 0; s < n; ++s)
 	{
-		cutoff = c;
+		float oversampled[Oversampling];
+		float output[Oversampling];
 
-		double fc =  cutoff / sampleRate;
-		double f  =  fc * 0.5; // oversampled 
-		double fc2 = fc * fc;
-		double fc3 = fc * fc * fc;
+		st.oversampler.Upsample(&samples[s], oversampled);
 
-		double fcr = 1.8730 * fc3 + 0.4955 * fc2 - 0.6490 * fc + 0.9988;
-		acr = -3.9364 * fc2 + 1.8409 * fc + 0.9968;
+		for (int j = 0; j < Oversampling; j++)
+		{
+			float input = oversampled[j] - resQuad * delay[5];
+			const float u = input;
+			delay[0] = stage[0] = delay[0] + tune * (tanh(input * thermal) - stageTanh[0]);
+			for (int k = 1; k < 4; k++)
+			{
+				input = stage[k-1];
+				stage[k] = delay[k] + tune * ((stageTanh[k-1] = tanh(input * thermal)) - (k != 3 ? stageTanh[k] : tanh(delay[k] * thermal)));
+				delay[k] = stage[k];
+			}
+			// 0.5 sample delay for phase compensation
+			delay[5] = (stage[3] + delay[4]) * 0.5;
+			delay[4] = stage[3];
 
-		tune = (1.0 - exp(-((2 * MOOG_PI) * f * fcr))) / thermal; 
+			if (lp4)
+			{
+				output[j] = delay[5];
+			}
+			else
+			{
+				const double mix = outputMix[0] * u + outputMix[1] * stage[0] + outputMix[2] * stage[1] + outputMix[3] * stage[2] + outputMix[4] * stage[3];
+				output[j] = (mix + st.lastMix) * 0.5;
+				st.lastMix = mix;
+			}
+		}
 
-		SetResonance(resonance);
+		st.oversampler.Downsample(output, &samples[s]);
 	}
+}
+
+template <int Oversampling>
+class HuovilainenMoogT : public LadderModel<HuovilainenCoeffsT<Oversampling>, HuovilainenStateT<Oversampling>>
+{
+	typedef LadderModel<HuovilainenCoeffsT<Oversampling>, HuovilainenStateT<Oversampling>> Base;
 	
-private:
+	// Not found in the dependent base otherwise
+	using Base::state;
+	using Base::coeffs;
+	using LadderFilterBase::cutoff;
+	using LadderFilterBase::resonance;
+	using LadderFilterBase::sampleRate;
+	using LadderFilterBase::outputMode;
 	
-	double stage[4];
-	double stageTanh[3];
-	double delay[6];
-
-	double thermal;
-	double tune;
-	double acr;
-	double resQuad;
+public:
+	
+	typedef LadderFilterBase::OutputMode OutputMode;
+	typedef LadderFilterBase::Parameter Parameter;
 	
+	HuovilainenMoogT(float sampleRate) : Base(sampleRate)
+	{
+		state.Init();
+		SetCutoff(1000.0f);
+		SetResonance(0.10f);
+	}
+	
+	virtual ~HuovilainenMoogT()
+	{
+		
+	}
+	
+	virtual void Process(float * samples, uint32_t n) override
+	{
+		moog_process(coeffs.Get(), state, samples, n);
+	}
+	
+	virtual bool SetOutputMode(OutputMode m) override
+	{
+		outputMode = m;
+		state.outputMode = m;
+		return true;
+	}
+	
+	virtual bool SetParameter(Parameter p, float value) override
+	{
+		// The state is scaled by thermal, so zero would wipe it
+		if (p != LadderFilterBase::THERMAL || !(value > 0.0f)) return false;
+		state.SetThermal(value);
+		return true;
+	}
+	
+	virtual bool GetParameter(Parameter p, float & value) override
+	{
+		if (p != LadderFilterBase::THERMAL) return false;
+		value = state.thermal;
+		return true;
+	}
+	
+	virtual void SetResonance(float r) override
+	{
+		resonance = r;
+		coeffs.Edit().SetResonance(r);
+	}
+	
+	virtual void SetCutoff(float c) override
+	{
+		cutoff = c;
+		coeffs.Edit().SetCutoff(sampleRate, c);
+	}
 }; 
 
+typedef HuovilainenCoeffsT<2> HuovilainenCoeffs;
+typedef HuovilainenStateT<2> HuovilainenState;
+typedef HuovilainenMoogT<2> HuovilainenMoog;
+typedef HuovilainenReferenceStateT<2> HuovilainenReferenceState;
+
 #endif
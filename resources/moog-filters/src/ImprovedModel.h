@@ -19,8 +19,11 @@ OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
 #ifndef IMPROVED_LADDER_H
 #define IMPROVED_LADDER_H
 
+#include "CoefficientCache.h"
 #include "LadderFilterBase.h"
 
+#include <string.h>
+
 /*
 This model is based on a reference implementation of an algorithm developed by
 Stefano D'Angelo and Vesa Valimaki, presented in a paper published at ICASSP in 2013.
@@ -35,17 +38,100 @@ Original Implementation: D'Angelo, Valimaki
 // Thermal voltage (26 milliwats at room temperature)
 #define VT 0.312
 
-class ImprovedMoog : public LadderFilterBase
+struct ImprovedCoeffs
 {
-public:
+	void SetCutoff(float sampleRate, float c)
+	{
+		cutoff = c;
+		twoSampleRate = 2.0 * sampleRate;
+		x = (MOOG_PI * cutoff) / sampleRate;
+		g = 4.0 * MOOG_PI * VT * cutoff * (1.0 - x) / (1.0 + x);
+	}
+	
+	void SetResonance(float r)
+	{
+		resonance = r;
+	}
 	
-	ImprovedMoog(float sampleRate) : LadderFilterBase(sampleRate)
+	float cutoff;
+	float resonance; // [0, 4]
+	double twoSampleRate;
+	double x;
+	double g;
+};
+
+struct ImprovedState
+{
+	void Init()
 	{
 		memset(V, 0, sizeof(V));
 		memset(dV, 0, sizeof(dV));
 		memset(tV, 0, sizeof(tV));
-		
 		drive = 1.0f;
+	}
+	
+	double V[4];
+	double dV[4];
+	double tV[4];
+	double drive;
+};
+
+template <bool DriveModulation>
+inline void moog_improved_run(const ImprovedCoeffs & c, ImprovedState & st, float * samples, const float * driveIn, uint32_t n)
+{
+	const double g = c.g;
+	const double resonance = c.resonance;
+	const double twoSampleRate = c.twoSampleRate;
+	double * V = st.V;
+	double * dV = st.dV;
+	double * tV = st.tV;
+	double dV0, dV1, dV2, dV3;
+
+	for (int i = 0; i < n; i++)
+	{
+		const double d = DriveModulation ? driveIn[i] : st.drive;
+		dV0 = -g * (tanh((d * samples[i] + resonance * V[3]) / (2.0 * VT)) + tV[0]);
+		V[0] += (dV0 + dV[0]) / twoSampleRate;
+		dV[0] = dV0;
+		tV[0] = tanh(V[0] / (2.0 * VT));
+		
+		dV1 = g * (tV[0] - tV[1]);
+		V[1] += (dV1 + dV[1]) / twoSampleRate;
+		dV[1] = dV1;
+		tV[1] = tanh(V[1] / (2.0 * VT));
+		
+		dV2 = g * (tV[1] - tV[2]);
+		V[2] += (dV2 + dV[2]) / twoSampleRate;
+		dV[2] = dV2;
+		tV[2] = tanh(V[2] / (2.0 * VT));
+		
+		dV3 = g * (tV[2] - tV[3]);
+		V[3] += (dV3 + dV[3]) / twoSampleRate;
+		dV[3] = dV3;
+		tV[3] = tanh(V[3] / (2.0 * VT));
+		
+		samples[i] = V[3];
+	}
+}
+
+inline void moog_process(const ImprovedCoeffs & c, ImprovedState & s, float * samples, uint32_t n)
+{
+	moog_improved_run<false>(c, s, samples, nullptr, n);
+}
+
+// Per-sample drive instead of ImprovedState::drive
+inline void moog_process(const ImprovedCoeffs & c, ImprovedState & s, float * samples, const float * drive, uint32_t n)
+{
+	moog_improved_run<true>(c, s, samples, drive, n);
+}
+
+class ImprovedMoog : public LadderModel<ImprovedCoeffs, ImprovedState>
+{
+public:
+	
+	ImprovedMoog(float sampleRate) : LadderModel(sampleRate)
+	{
+		state.Init();
 		
 		SetCutoff(1000.0f); // normalized cutoff frequency
 		SetResonance(0.1f); // [0, 4]
@@ -55,55 +141,39 @@ public:
 	
 	virtual void Process(float * samples, uint32_t n) override
 	{
-		double dV0, dV1, dV2, dV3;
-
-		for (int i = 0; i < n; i++)
-		{
-			dV0 = -g * (tanh((drive * samples[i] + resonance * V[3]) / (2.0 * VT)) + tV[0]);
-			V[0] += (dV0 + dV[0]) / (2.0 * sampleRate);
-			dV[0] = dV0;
-			tV[0] = tanh(V[0] / (2.0 * VT));
-			
-			dV1 = g * (tV[0] - tV[1]);
-			V[1] += (dV1 + dV[1]) / (2.0 * sampleRate);
-			dV[1] = dV1;
-			tV[1] = tanh(V[1] / (2.0 * VT));
-			
-			dV2 = g * (tV[1] - tV[2]);
-			V[2] += (dV2 + dV[2]) / (2.0 * sampleRate);
-			dV[2] = dV2;
-			tV[2] = tanh(V[2] / (2.0 * VT));
-			
-			dV3 = g * (tV[2] - tV[3]);
-			V[3] += (dV3 + dV[3]) / (2.0 * sampleRate);
-			dV[3] = dV3;
-			tV[3] = tanh(V[3] / (2.0 * VT));
-			
-			samples[i] = V[3];
-		}
+		moog_process(coeffs.Get(), state, samples, n);
+	}
+	
+	virtual void ProcessWithDrive(float * samples, const float * drive, uint32_t n) override
+	{
+		moog_process(coeffs.Get(), state, samples, drive, n);
+	}
+	
+	virtual bool SetParameter(Parameter p, float value) override
+	{
+		if (p != DRIVE) return false;
+		state.drive = value;
+		return true;
+	}
+	
+	virtual bool GetParameter(Parameter p, float & value) override
+	{
+		if (p != DRIVE) return false;
+		value = state.drive;
+		return true;
 	}
 	
 	virtual void SetResonance(float r) override
 	{
 		resonance = r;
+		coeffs.Edit().SetResonance(r);
 	}
 	
 	virtual void SetCutoff(float c) override
 	{
 		cutoff = c;
-		x = (MOOG_PI * cutoff) / sampleRate;
-		g = 4.0 * MOOG_PI * VT * cutoff * (1.0 - x) / (1.0 + x);
+		coeffs.Edit().SetCutoff(sampleRate, c);
 	}
-	
-private:
-	
-	double V[4];
-	double dV[4];
-	double tV[4];
-	
-	double x;
-	double g;
-	double drive;
 };
 
 #endif
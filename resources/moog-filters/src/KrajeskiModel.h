@@ -3,9 +3,12 @@
 #ifndef KRAJESKI_LADDER_H
 #define KRAJESKI_LADDER_H
 
+#include "CoefficientCache.h"
 #include "LadderFilterBase.h"
 #include "Util.h"
 
+#include <string.h>
+
 /*
 This class implements Tim Stilson's MoogVCF filter
 using 'compromise' poles at z = -0.3
@@ -24,19 +27,114 @@ You may use it however you might like."
 Source: http://song-swap.com/MUMT618/aaron/Presentation/demo.html
 */
 
-class KrajeskiMoog final : public LadderFilterBase
+struct KrajeskiCoeffs
 {
+	// Resonance correction depends on the cutoff, so it is refreshed as well
+	void SetCutoff(float sampleRate, float c)
+	{
+		cutoff = c;
+		wc = 2 * MOOG_PI * cutoff / sampleRate;
+		g = 0.9892 * wc - 0.4342 * pow(wc, 2) + 0.1381 * pow(wc, 3) - 0.0202 * pow(wc, 4);
+		SetResonance(resonance);
+	}
 	
-public:
+	void SetResonance(float r)
+	{
+		resonance = r;
+		gRes = resonance * (1.0029 + 0.0526 * wc - 0.926 * pow(wc, 2) + 0.0218 * pow(wc, 3));
+	}
 	
-    KrajeskiMoog(float sampleRate) : LadderFilterBase(sampleRate)
+	float cutoff;
+	float resonance;
+	double wc; // The angular frequency of the cutoff.
+	double g; // A derived parameter for the cutoff frequency
+	double gRes; // A similar derived parameter for resonance.
+};
+
+struct KrajeskiState
+{
+	void Init()
 	{
 		memset(state, 0, sizeof(state));
 		memset(delay, 0, sizeof(delay));
-		
 		drive = 1.0;
 		gComp = 1.0;
+		outputMode = LadderFilterBase::LP4;
+	}
+	
+	double state[5];
+	double delay[5];
+	double gComp; // Compensation factor.
+	double drive; // A parameter that controls intensity of nonlinearities.
+	LadderFilterBase::OutputMode outputMode;
+};
+
+inline float moog_krajeski_clamp(float in, float min, float max)
+{
+	return fmin(fmax(in, min), max);
+}
+
+template <bool WriteTaps, bool DriveModulation>
+inline void moog_krajeski_run(const KrajeskiCoeffs & c, KrajeskiState & st, const float * in, float * out, const float * driveIn, uint32_t n)
+{
+	const int NUM_TAPS = LadderFilterBase::NUM_TAPS;
+	const double g = c.g;
+	const double gRes = c.gRes;
+	double * state = st.state;
+	double * delay = st.delay;
+	
+	double outputMix[NUM_TAPS];
+	LadderFilterBase::GetOutputModeWeights(st.outputMode, outputMix);
+	
+	for (int s = 0; s < n; ++s)
+	{
+		const double d = DriveModulation ? driveIn[s] : st.drive;
+		state[0] = tanh(d * (in[s] - 4 * gRes * (state[4] - st.gComp * in[s])));
 		
+		for(int i = 0; i < 4; i++)
+		{
+			state[i+1] = moog_krajeski_clamp(g * (0.3 / 1.3 * state[i] + 1 / 1.3 * delay[i] - state[i + 1]) + state[i + 1], -1e30, 1e30);
+			
+			delay[i] = state[i];
+		}
+		
+		if (WriteTaps)
+		{
+			for (int i = 0; i < NUM_TAPS; i++) out[s * NUM_TAPS + i] = state[i];
+		}
+		else
+		{
+			out[s] = outputMix[0] * state[0] + outputMix[1] * state[1] + outputMix[2] * state[2] + outputMix[3] * state[3] + outputMix[4] * state[4];
+		}
+	}
+}
+
+inline void moog_process(const KrajeskiCoeffs & c, KrajeskiState & s, float * samples, uint32_t n)
+{
+	moog_krajeski_run<false, false>(c, s, samples, samples, nullptr, n);
+}
+
+// Per-sample drive instead of KrajeskiState::drive
+inline void moog_process(const KrajeskiCoeffs & c, KrajeskiState & s, float * samples, const float * drive, uint32_t n)
+{
+	moog_krajeski_run<false, true>(c, s, samples, samples, drive, n);
+}
+
+// Writes NUM_TAPS values per sample: the saturated input and the four stage
+// outputs. See LadderFilterBase::MixTaps.
+inline void moog_process_taps(const KrajeskiCoeffs & c, KrajeskiState & s, const float * input, float * taps, uint32_t n)
+{
+	moog_krajeski_run<true, false>(c, s, input, taps, nullptr, n);
+}
+
+class KrajeskiMoog final : public LadderModel<KrajeskiCoeffs, KrajeskiState>
+{
+	
+public:
+	
+    KrajeskiMoog(float sampleRate) : LadderModel(sampleRate)
+	{
+		state.Init();
 		SetCutoff(1000.0f);
 		SetResonance(0.1f);
 	}
@@ -45,47 +143,57 @@ public:
 	
 	virtual void Process(float * samples, const uint32_t n) override
 	{
-		for (int s = 0; s < n; ++s)
+		moog_process(coeffs.Get(), state, samples, n);
+	}
+	
+	virtual void ProcessWithDrive(float * samples, const float * drive, const uint32_t n) override
+	{
+		moog_process(coeffs.Get(), state, samples, drive, n);
+	}
+	
+	void ProcessTaps(const float * input, float * taps, const uint32_t n)
+	{
+		moog_process_taps(coeffs.Get(), state, input, taps, n);
+	}
+	
+	virtual bool SetOutputMode(OutputMode m) override
+	{
+		outputMode = m;
+		state.outputMode = m;
+		return true;
+	}
+	
+	virtual bool SetParameter(Parameter p, float value) override
+	{
+		switch (p)
 		{
-			state[0] = tanh(drive * (samples[s] - 4 * gRes * (state[4] - gComp * samples[s])));
-			
-			for(int i = 0; i < 4; i++)
-			{
-				state[i+1] = fclamp(g * (0.3 / 1.3 * state[i] + 1 / 1.3 * delay[i] - state[i + 1]) + state[i + 1], -1e30, 1e30);
-				
-				delay[i] = state[i];
-			}
-			samples[s] = state[4];
+			case DRIVE: state.drive = value; return true;
+			case GAIN_COMPENSATION: state.gComp = value; return true;
+			default: return false;
+		}
+	}
+	
+	virtual bool GetParameter(Parameter p, float & value) override
+	{
+		switch (p)
+		{
+			case DRIVE: value = state.drive; return true;
+			case GAIN_COMPENSATION: value = state.gComp; return true;
+			default: return false;
 		}
 	}
 	
 	virtual void SetResonance(float r) override
 	{
 		resonance = r;
-		gRes = resonance * (1.0029 + 0.0526 * wc - 0.926 * pow(wc, 2) + 0.0218 * pow(wc, 3));
+		coeffs.Edit().SetResonance(r);
 	}
 	
 	virtual void SetCutoff(float c) override
 	{
 		cutoff = c;
-		wc = 2 * MOOG_PI * cutoff / sampleRate;
-		g = 0.9892 * wc - 0.4342 * pow(wc, 2) + 0.1381 * pow(wc, 3) - 0.0202 * pow(wc, 4);
+		coeffs.Edit().SetCutoff(sampleRate, c);
 	}
-	
-private:
-	
-	double state[5];
-	double delay[5];
-	double wc; // The angular frequency of the cutoff.
-	double g; // A derived parameter for the cutoff frequency
-	double gRes; // A similar derived parameter for resonance.
-	double gComp; // Compensation factor.
-	double drive; // A parameter that controls intensity of nonlinearities.
-	
-	inline float fclamp(float in, float min, float max){
-	    return fmin(fmax(in, min), max);
-	}
-	
 };
 
 #endif
@@ -5,25 +5,128 @@
 
 #include "Util.h"
 
+/*
+Common interface of the ladder models.
+
+Each model is split into two plain structs: Coeffs, everything derived from
+cutoff and resonance, and State, what a single voice updates or sets on its
+own (stage values, drive, output mode). Neither holds pointers, so the states
+of many voices can be packed into one array, and the same Coeffs can be read
+by all voices that share their settings (see CoefficientCache.h). The
+per-sample work is done by free kernels,
+
+	moog_process(const XCoeffs & c, XState & s, float * samples, uint32_t n)
+
+overloaded for each model, plus moog_process_taps and drive overloads where a
+model supports them. The model classes wrap one State and one Coeffs behind
+the virtual interface below, through LadderModel in CoefficientCache.h.
+*/
+
 class LadderFilterBase
 {
 public:
 	
-	LadderFilterBase(float sampleRate) : sampleRate(sampleRate) {}
+	// Responses mixed from the ladder taps (input after feedback and the four
+	// stage outputs), in the style of the Oberheim Xpander
+	enum OutputMode
+	{
+		LP1,
+		LP2,
+		LP3,
+		LP4,
+		HP1,
+		HP2,
+		HP3,
+		HP4,
+		BP2,
+		BP4
+	};
+	
+	// Model-specific parameters beyond cutoff and resonance
+	enum Parameter
+	{
+		DRIVE,
+		THERMAL,
+		SATURATION,
+		Q_FACTOR,
+		GAIN_COMPENSATION
+	};
+	
+	// Number of values written per sample by the models' ProcessTaps()
+	static const int NUM_TAPS = 5;
+	
+	LadderFilterBase(float sampleRate) : sampleRate(sampleRate)
+	{
+		outputMode = LP4;
+	}
 	virtual ~LadderFilterBase() {}
 	
 	virtual void Process(float * samples, uint32_t n) = 0;
 	virtual void SetResonance(float r) = 0;
 	virtual void SetCutoff(float c) = 0;
 	
+	// Returns false if the model only produces its native 4-pole lowpass
+	virtual bool SetOutputMode(OutputMode m) { return m == LP4; }
+	
+	// Both return false if the model does not have the parameter, and
+	// SetParameter also for a value the model cannot run with (e.g. a
+	// non-positive thermal or saturation), which it then ignores. Setting a
+	// parameter only recomputes the constants that depend on it.
+	virtual bool SetParameter(Parameter, float) { return false; }
+	virtual bool GetParameter(Parameter, float &) { return false; }
+	
+	// Per-sample drive. Models without an internal drive stage treat it as an
+	// input gain in front of the ladder.
+	virtual void ProcessWithDrive(float * samples, const float * drive, uint32_t n)
+	{
+		for (int s = 0; s < n; ++s) samples[s] *= drive[s];
+		Process(samples, n);
+	}
+	
 	float GetResonance() { return resonance; }
 	float GetCutoff() { return cutoff; }
+	OutputMode GetOutputMode() { return outputMode; }
+	
+	static void GetOutputModeWeights(OutputMode m, double * w)
+	{
+		static const double weights[][NUM_TAPS] =
+		{
+			{ 0.0,  1.0,  0.0,  0.0, 0.0 }, // LP1
+			{ 0.0,  0.0,  1.0,  0.0, 0.0 }, // LP2
+			{ 0.0,  0.0,  0.0,  1.0, 0.0 }, // LP3
+			{ 0.0,  0.0,  0.0,  0.0, 1.0 }, // LP4
+			{ 1.0, -1.0,  0.0,  0.0, 0.0 }, // HP1
+			{ 1.0, -2.0,  1.0,  0.0, 0.0 }, // HP2
+			{ 1.0, -3.0,  3.0, -1.0, 0.0 }, // HP3
+			{ 1.0, -4.0,  6.0, -4.0, 1.0 }, // HP4
+			{ 0.0,  2.0, -2.0,  0.0, 0.0 }, // BP2
+			{ 0.0,  0.0,  4.0, -8.0, 4.0 }, // BP4
+		};
+		
+		for (int i = 0; i < NUM_TAPS; ++i) w[i] = weights[m][i];
+	}
+	
+	// Derives any response from a buffer filled by ProcessTaps(), so several
+	// outputs can come from a single pass through the ladder
+	static void MixTaps(const float * taps, float * output, uint32_t n, OutputMode m)
+	{
+		double w[NUM_TAPS];
+		GetOutputModeWeights(m, w);
+		
+		for (int s = 0; s < n; ++s)
+		{
+			const float * t = taps + s * NUM_TAPS;
+			output[s] = w[0] * t[0] + w[1] * t[1] + w[2] * t[2] + w[3] * t[3] + w[4] * t[4];
+		}
+	}
 	
 protected:
 	
 	float cutoff;
 	float resonance;
 	float sampleRate;
+	
+	OutputMode outputMode;
 };
 
 #endif
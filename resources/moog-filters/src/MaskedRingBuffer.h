@@ -0,0 +1,255 @@
+#pragma once
+
+#ifndef MASKED_RING_BUFFER_H
+#define MASKED_RING_BUFFER_H
+
+#include "Util.h"
+
+#include <atomic>
+#include <stdexcept>
+#include <type_traits>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(_WIN32)
+	#include <malloc.h>
+#else
+	#include <sys/mman.h>
+	#include <unistd.h>
+#endif
+
+/*
+Single-producer/single-consumer ring with the same interface and
+acquire/release protocol as RingBufferT, built for large multichannel buffers.
+
+The capacity is a power of two and the read and write indices run freely, so
+positions are found with a mask and the fill level is a plain difference. No
+slot is sacrificed to tell a full ring from an empty one. The two indices sit on
+separate cache lines so the producer and consumer do not invalidate each other
+on every update.
+
+Storage is 64-byte aligned. RING_HUGE_PAGES aligns it to 2 MB and asks the
+kernel for transparent huge pages (Linux only, otherwise a hint that is
+ignored). RING_MIRRORED maps the same memfd twice back to back, so a block that
+wraps past the end continues seamlessly in the second mapping and every read
+and write is one contiguous memcpy. The capacity is then rounded up to whole
+pages. Mirroring needs Linux; elsewhere, or if the mapping fails, the ring falls
+back to RING_ALIGNED, which getAllocation() reports.
+*/
+
+enum RingAllocation
+{
+	RING_ALIGNED,
+	RING_HUGE_PAGES,
+	RING_MIRRORED
+};
+
+template <typename T>
+class MaskedRingBufferT
+{
+	static_assert(std::is_trivially_copyable<T>::value, "Ring elements are copied with memcpy");
+
+	NO_COPY(MaskedRingBufferT);
+
+public:
+
+	MaskedRingBufferT() : writeIndex(0), readIndex(0) {}
+
+	MaskedRingBufferT(size_t count, RingAllocation allocation = RING_ALIGNED) : writeIndex(0), readIndex(0)
+	{
+		resize(count, allocation);
+	}
+
+	~MaskedRingBufferT() { release(); }
+
+	// Holds at least count elements. Resets both indices, so it must be
+	// synchronized with the read and write threads.
+	void resize(size_t count, RingAllocation allocation = RING_ALIGNED)
+	{
+		release();
+
+		size_t capacity = 1;
+		while (capacity < count) capacity <<= 1;
+
+		if (allocation == RING_MIRRORED && !allocateMirrored(capacity)) allocation = RING_ALIGNED;
+		if (allocation != RING_MIRRORED) allocate(capacity, allocation);
+
+		clear();
+	}
+
+	void clear()
+	{
+		writeIndex.store(0);
+		readIndex.store(0);
+	}
+
+	size_t getSize() const { return capacity; }
+	RingAllocation getAllocation() const { return allocation; }
+
+	// Only safe to call from the write thread
+	size_t getAvailableWrite() const
+	{
+		return capacity - (writeIndex.load(std::memory_order_relaxed) - readIndex.load(std::memory_order_acquire));
+	}
+
+	// Only safe to call from the read thread
+	size_t getAvailableRead() const
+	{
+		return writeIndex.load(std::memory_order_acquire) - readIndex.load(std::memory_order_relaxed);
+	}
+
+	// Writes all count elements or none. Only safe to call from the write thread.
+	bool write(const T * array, size_t count)
+	{
+		const size_t w = writeIndex.load(std::memory_order_relaxed);
+		const size_t r = readIndex.load(std::memory_order_acquire);
+
+		if (count > capacity - (w - r)) return false;
+
+		const size_t i = w & mask;
+		if (allocation == RING_MIRRORED || i + count <= capacity)
+		{
+			memcpy(data + i, array, count * sizeof(T));
+		}
+		else
+		{
+			const size_t first = capacity - i;
+			memcpy(data + i, array, first * sizeof(T));
+			memcpy(data, array + first, (count - first) * sizeof(T));
+		}
+
+		writeIndex.store(w + count, std::memory_order_release);
+		return true;
+	}
+
+	// Reads all count elements or none. Only safe to call from the read thread.
+	bool read(T * array, size_t count)
+	{
+		const size_t w = writeIndex.load(std::memory_order_acquire);
+		const size_t r = readIndex.load(std::memory_order_relaxed);
+
+		if (count > w - r) return false;
+
+		const size_t i = r & mask;
+		if (allocation == RING_MIRRORED || i + count <= capacity)
+		{
+			memcpy(array, data + i, count * sizeof(T));
+		}
+		else
+		{
+			const size_t first = capacity - i;
+			memcpy(array, data + i, first * sizeof(T));
+			memcpy(array + first, data, (count - first) * sizeof(T));
+		}
+
+		readIndex.store(r + count, std::memory_order_release);
+		return true;
+	}
+
+private:
+
+	void allocate(size_t count, RingAllocation mode)
+	{
+		size_t alignment = 64;
+		size_t bytes = count * sizeof(T);
+
+		if (mode == RING_HUGE_PAGES)
+		{
+			alignment = 2 * 1024 * 1024;
+			bytes = (bytes + alignment - 1) & ~(alignment - 1);
+		}
+
+#if defined(_WIN32)
+		void * memory = _aligned_malloc(bytes, alignment);
+#else
+		void * memory = nullptr;
+		if (posix_memalign(&memory, alignment, bytes) != 0) memory = nullptr;
+#endif
+		if (!memory) throw std::runtime_error("ring allocation failed");
+
+#if defined(__linux__) && defined(MADV_HUGEPAGE)
+		if (mode == RING_HUGE_PAGES) madvise(memory, bytes, MADV_HUGEPAGE);
+#endif
+
+		// Zeroing also faults every page in before the audio thread gets to it
+		memset(memory, 0, bytes);
+
+		data = (T *) memory;
+		capacity = count;
+		mask = capacity - 1;
+		allocation = mode;
+		mappedBytes = 0;
+	}
+
+	bool allocateMirrored(size_t count)
+	{
+#if defined(__linux__)
+		const size_t page = (size_t) sysconf(_SC_PAGESIZE);
+		while ((count * sizeof(T)) % page) count <<= 1;
+		const size_t bytes = count * sizeof(T);
+
+		const int fd = memfd_create("moog-ring", MFD_CLOEXEC);
+		if (fd < 0) return false;
+
+		// Reserve twice the size, then map the file over both halves
+		uint8_t * base = (uint8_t *) mmap(nullptr, 2 * bytes, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		bool ok = base != MAP_FAILED && ftruncate(fd, bytes) == 0;
+		ok = ok && mmap(base, bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) != MAP_FAILED;
+		ok = ok && mmap(base + bytes, bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) != MAP_FAILED;
+		close(fd);
+
+		if (!ok)
+		{
+			if (base != MAP_FAILED) munmap(base, 2 * bytes);
+			return false;
+		}
+
+		memset(base, 0, bytes);
+
+		data = (T *) base;
+		capacity = count;
+		mask = count - 1;
+		allocation = RING_MIRRORED;
+		mappedBytes = 2 * bytes;
+		return true;
+#else
+		return false;
+#endif
+	}
+
+	void release()
+	{
+		if (!data) return;
+
+#if defined(__linux__)
+		if (mappedBytes) munmap(data, mappedBytes);
+		else free(data);
+#elif defined(_WIN32)
+		_aligned_free(data);
+#else
+		free(data);
+#endif
+
+		data = nullptr;
+		capacity = 0;
+		mask = 0;
+		mappedBytes = 0;
+	}
+
+	T * data = nullptr;
+	size_t capacity = 0;
+	size_t mask = 0;
+	size_t mappedBytes = 0;
+	RingAllocation allocation = RING_ALIGNED;
+
+	char padding0[64];
+	std::atomic<size_t> writeIndex;
+	char padding1[64];
+	std::atomic<size_t> readIndex;
+	char padding2[64];
+};
+
+typedef MaskedRingBufferT<float> MaskedRingBuffer;
+
+#endif
@@ -6,17 +6,88 @@
 #ifndef MICROTRACKER_MODEL_H
 #define MICROTRACKER_MODEL_H
 
+#include "CoefficientCache.h"
 #include "LadderFilterBase.h"
 #include "Util.h"
 
-class MicrotrackerMoog : public LadderFilterBase
+#include <string.h>
+
+struct MicrotrackerCoeffs
+{
+	void SetCutoff(float sampleRate, float c)
+	{
+		cutoff = c;
+		omega = moog_min(c * 2 * MOOG_PI / sampleRate, 1);
+	}
+
+	void SetResonance(float r)
+	{
+		resonance = r;
+		k = resonance * 4;
+	}
+
+	float cutoff;
+	float resonance;
+	double omega; // cutoff in radians per sample, at most 1
+	double k; // feedback gain
+};
+
+struct MicrotrackerState
+{
+	void Init()
+	{
+		memset(p, 0, sizeof(p));
+		memset(pTanh, 0, sizeof(pTanh));
+		memset(history, 0, sizeof(history));
+	}
+
+	double p[4]; // ladder stages, contiguous so they fit a single 256-bit register
+	double pTanh[4]; // fast_tanh(p[i]) carried over from the previous sample
+	double history[3]; // p3 delayed by 1, 2 and 3 samples
+};
+
+inline void moog_process(const MicrotrackerCoeffs & c, MicrotrackerState & st, float * samples, uint32_t n)
+{
+	const double k = c.k;
+	const double cutoff = c.omega;
+	double * p = st.p;
+	double * pTanh = st.pTanh;
+	double * history = st.history;
+
+	for (int s = 0; s < n; ++s)
+	{
+		// Coefficients optimized using differential evolution
+		// to make feedback gain 4.0 correspond closely to the
+		// border of instability, for all values of omega.
+		double out = p[3] * 0.360891 + history[0] * 0.417290 + history[1] * 0.177896 + history[2] * 0.0439725;
+
+		history[2] = history[1];
+		history[1] = history[0];
+		history[0] = p[3];
+
+		// pTanh[i] always holds fast_tanh(p[i]), so each stage only has to
+		// evaluate the tanh of its freshly updated value (5 per sample instead of 8)
+		p[0] += (fast_tanh(samples[s] - k * out) - pTanh[0]) * cutoff;
+		pTanh[0] = fast_tanh(p[0]);
+		p[1] += (pTanh[0] - pTanh[1]) * cutoff;
+		pTanh[1] = fast_tanh(p[1]);
+		p[2] += (pTanh[1] - pTanh[2]) * cutoff;
+		pTanh[2] = fast_tanh(p[2]);
+		p[3] += (pTanh[2] - pTanh[3]) * cutoff;
+		pTanh[3] = fast_tanh(p[3]);
+
+		samples[s] = out;
+	}
+}
+
+class MicrotrackerMoog : public LadderModel<MicrotrackerCoeffs, MicrotrackerState>
 {
 
 public:
 
-	MicrotrackerMoog(float sampleRate) : LadderFilterBase(sampleRate)
+	MicrotrackerMoog(float sampleRate) : LadderModel(sampleRate)
 	{
-		p0 = p1 = p2 = p3 = p32 = p33 = p34 = 0.0;
+		state.Init();
 		SetCutoff(1000.0f);
 		SetResonance(0.10f);
 	}
@@ -25,47 +96,110 @@ public:
 
 	virtual void Process(float * samples, uint32_t n) override
 	{
-		double k = resonance * 4;
-		for (int s = 0; s < n; ++s)
-		{
-			// Coefficients optimized using differential evolution
-			// to make feedback gain 4.0 correspond closely to the
-			// border of instability, for all values of omega.
-			double out = p3 * 0.360891 + p32 * 0.417290 + p33 * 0.177896 + p34 * 0.0439725;
+		moog_process(coeffs.Get(), state, samples, n);
+	}
 
-			p34 = p33;
-			p33 = p32;
-			p32 = p3;
+	virtual void SetResonance(float r) override
+	{
+		resonance = r;
+		coeffs.Edit().SetResonance(r);
+	}
 
-			p0 += (fast_tanh(samples[s] - k * out) - fast_tanh(p0)) * cutoff;
-			p1 += (fast_tanh(p0) - fast_tanh(p1)) * cutoff;
-			p2 += (fast_tanh(p1) - fast_tanh(p2)) * cutoff;
-			p3 += (fast_tanh(p2) - fast_tanh(p3)) * cutoff;
+	virtual void SetCutoff(float c) override
+	{
+		cutoff = c;
+		coeffs.Edit().SetCutoff(sampleRate, c);
+	}
+};
+
+/*
+Processes several independent Microtracker voices at once. Each voice occupies
+one lane and every stage of the ladder is evaluated for all lanes before moving
+on to the next one, so the rational fast_tanh (and everything else) vectorizes
+across voices. Samples are interleaved by voice: samples[frame * Voices + voice].
+*/
+
+template <int Voices>
+class MicrotrackerMoogBank
+{
+	NO_COPY(MicrotrackerMoogBank);
+
+public:
 
-			samples[s] = out;
+	MicrotrackerMoogBank(float sampleRate) : sampleRate(sampleRate)
+	{
+		memset(p, 0, sizeof(p));
+		memset(pTanh, 0, sizeof(pTanh));
+		memset(history, 0, sizeof(history));
+		for (int v = 0; v < Voices; ++v)
+		{
+			SetCutoff(v, 1000.0f);
+			SetResonance(v, 0.10f);
 		}
 	}
 
-	virtual void SetResonance(float r) override
+	void Process(float * samples, uint32_t n)
 	{
-		resonance = r;
+		for (int s = 0; s < n; ++s)
+		{
+			float * frame = samples + s * Voices;
+			double out[Voices];
+
+			for (int v = 0; v < Voices; ++v)
+			{
+				out[v] = p[3][v] * 0.360891 + history[0][v] * 0.417290 + history[1][v] * 0.177896 + history[2][v] * 0.0439725;
+				history[2][v] = history[1][v];
+				history[1][v] = history[0][v];
+				history[0][v] = p[3][v];
+			}
+
+			for (int v = 0; v < Voices; ++v)
+			{
+				p[0][v] += (fast_tanh(frame[v] - k[v] * out[v]) - pTanh[0][v]) * omega[v];
+				pTanh[0][v] = fast_tanh(p[0][v]);
+			}
+
+			for (int i = 1; i < 4; ++i)
+			{
+				for (int v = 0; v < Voices; ++v)
+				{
+					p[i][v] += (pTanh[i-1][v] - pTanh[i][v]) * omega[v];
+					pTanh[i][v] = fast_tanh(p[i][v]);
+				}
+			}
+
+			for (int v = 0; v < Voices; ++v)
+			{
+				frame[v] = out[v];
+			}
+		}
 	}
 
-	virtual void SetCutoff(float c) override
+	void SetResonance(int voice, float r)
+	{
+		resonance[voice] = r;
+		k[voice] = r * 4;
+	}
+
+	void SetCutoff(int voice, float c)
 	{
-		cutoff = c * 2 * MOOG_PI / sampleRate;
-		cutoff = moog_min(cutoff, 1);
+		cutoff[voice] = c;
+		omega[voice] = moog_min(c * 2 * MOOG_PI / sampleRate, 1);
 	}
 
+	float GetResonance(int voice) const { return resonance[voice]; }
+	float GetCutoff(int voice) const { return cutoff[voice]; }
+
 private:
 
-	double p0;
-	double p1;
-	double p2;
-	double p3;
-	double p32;
-	double p33;
-	double p34;
+	alignas(32) double p[4][Voices];
+	alignas(32) double pTanh[4][Voices];
+	alignas(32) double history[3][Voices];
+	alignas(32) double omega[Voices]; // cutoff in radians per sample, at most 1
+	alignas(32) double k[Voices];
+	float cutoff[Voices];
+	float resonance[Voices];
+	float sampleRate;
 };
 
 #endif
@@ -0,0 +1,111 @@
+#pragma once
+
+#ifndef MIXING_RING_BUFFER_H
+#define MIXING_RING_BUFFER_H
+
+#include "Util.h"
+#include "RingBuffer.h"
+
+#include <algorithm>
+#include <atomic>
+#include <vector>
+
+/*
+Several render threads feeding one output without a mixing thread. Every
+producer owns a single-producer/single-consumer RingBufferT, so producers never
+contend with each other, and the consumer sums one block from each ring
+straight into the output. Every step on the consumer side is a bounded copy or
+add, so ReadMix is wait-free and safe to call from the audio callback.
+
+Producers stay aligned on a common timeline. A producer that has not delivered
+its block when the consumer mixes is skipped for that block, and its next
+`count` samples are discarded once they arrive, so a late voice drops out
+briefly instead of drifting behind the others.
+*/
+
+template <typename T>
+class MixingRingBufferT
+{
+	NO_COPY(MixingRingBufferT);
+
+public:
+
+	// capacity is per producer; maxBlock is the largest count passed to ReadMix
+	MixingRingBufferT(int numProducers, size_t capacity, size_t maxBlock) : scratch(maxBlock), lanes(numProducers)
+	{
+		for (auto & lane : lanes) lane.ring.resize(capacity);
+	}
+
+	// Producer thread `producer` only
+	bool Write(int producer, const T * data, size_t count)
+	{
+		return lanes[producer].ring.write(data, count);
+	}
+
+	// Producer thread `producer` only
+	size_t GetAvailableWrite(int producer) const
+	{
+		return lanes[producer].ring.getAvailableWrite();
+	}
+
+	// Consumer only. Sums `count` samples from every producer into out
+	// (overwriting it) and returns how many producers contributed.
+	int ReadMix(T * out, size_t count)
+	{
+		memset(out, 0, count * sizeof(T));
+		int mixed = 0;
+
+		for (auto & lane : lanes)
+		{
+			size_t available = lane.ring.getAvailableRead();
+
+			// Catch up on blocks that were skipped
+			while (lane.debt && available)
+			{
+				const size_t drop = std::min(std::min(lane.debt, available), scratch.size());
+				lane.ring.read(scratch.data(), drop);
+				lane.debt -= drop;
+				available -= drop;
+			}
+
+			if (lane.debt || available < count)
+			{
+				lane.debt += count;
+				lane.missed.fetch_add(1, std::memory_order_relaxed);
+				continue;
+			}
+
+			lane.ring.read(scratch.data(), count);
+			const T * in = scratch.data();
+			for (size_t i = 0; i < count; ++i) out[i] += in[i];
+			++mixed;
+		}
+
+		return mixed;
+	}
+
+	int GetNumProducers() const { return (int) lanes.size(); }
+
+	// Blocks the consumer had to mix without this producer
+	uint64_t GetMissedBlocks(int producer) const
+	{
+		return lanes[producer].missed.load(std::memory_order_relaxed);
+	}
+
+private:
+
+	struct Lane
+	{
+		RingBufferT<T> ring;
+		size_t debt = 0; // consumer only
+		std::atomic<uint64_t> missed { 0 };
+		char padding[64]; // keeps the ring indices of neighbouring producers off each other's cache line
+	};
+
+	std::vector<T> scratch;
+	std::vector<Lane> lanes;
+};
+
+typedef MixingRingBufferT<float> MixingRingBuffer;
+
+#endif
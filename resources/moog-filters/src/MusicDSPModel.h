@@ -8,18 +8,147 @@
 #ifndef MUSICDSP_MOOG_H
 #define MUSICDSP_MOOG_H
 
+#include "CoefficientCache.h"
 #include "LadderFilterBase.h"
 #include "Util.h"
 
-class MusicDSPMoog : public LadderFilterBase
+#include <string.h>
+
+struct MusicDSPCoeffs
 {
+	void SetCutoff(float sampleRate, float c)
+	{
+		cutoff = c;
+		fc = 2.0 * c / sampleRate;
+
+		p = fc * (1.8 - 0.8 * fc);
+		k = 2.0 * sin(fc * MOOG_PI * 0.5) - 1.0;
+		
+		double t1 = (1.0 - p) * 1.386249;
+		double t2 = 12.0 + t1 * t1;
+		resonanceScale = (t2 + 6.0 * t1) / (t2 - 6.0 * t1);
+
+		feedback = resonance * resonanceScale;
+	}
 	
-public:
+	void SetResonance(float r)
+	{
+		resonance = r;
+		feedback = r * resonanceScale;
+	}
 	
-	MusicDSPMoog(float sampleRate) : LadderFilterBase(sampleRate)
+	float cutoff;
+	float resonance;
+	double fc; // relative to Nyquist
+	double p;
+	double k;
+	double resonanceScale;
+	double feedback;
+};
+
+struct MusicDSPState
+{
+	void Init()
 	{
 		memset(stage, 0, sizeof(stage));
 		memset(delay, 0, sizeof(delay));
+		outputMode = LadderFilterBase::LP4;
+	}
+	
+	double stage[4];
+	double delay[4];
+	LadderFilterBase::OutputMode outputMode;
+};
+
+template <bool WriteTaps>
+inline void moog_musicdsp_run(const MusicDSPCoeffs & c, MusicDSPState & st, const float * in, float * out, uint32_t n)
+{
+	const int NUM_TAPS = LadderFilterBase::NUM_TAPS;
+	const double p = c.p;
+	const double k = c.k;
+	const double feedback = c.feedback;
+	const bool lp4 = st.outputMode == LadderFilterBase::LP4;
+
+	// The one-pole sections have a DC gain of 2p / (1 + k) rather than unity, so
+	// the weights of the higher stages are normalized for the highpass and
+	// bandpass responses to null properly
+	double outputMix[NUM_TAPS];
+	double tapGain[NUM_TAPS];
+	LadderFilterBase::GetOutputModeWeights(st.outputMode, outputMix);
+	const double stageGain = (1.0 + k) / (2.0 * p);
+	tapGain[0] = 1.0;
+	for (int i = 1; i < NUM_TAPS; ++i)
+	{
+		tapGain[i] = tapGain[i - 1] * stageGain;
+		if (!lp4) outputMix[i] *= tapGain[i];
+	}
+
+	double s0 = st.stage[0], s1 = st.stage[1], s2 = st.stage[2], s3 = st.stage[3];
+	double d0 = st.delay[0], d1 = st.delay[1], d2 = st.delay[2], d3 = st.delay[3];
+
+	for (int s = 0; s < n; ++s)
+	{
+		float x = in[s] - feedback * s3;
+
+		// Four cascaded one-pole filters (bilinear transform)
+		s0 = x * p + d0 * p - k * s0;
+		d0 = x;
+		s1 = s0 * p + d1 * p - k * s1;
+		d1 = s0;
+		s2 = s1 * p + d2 * p - k * s2;
+		d2 = s1;
+		s3 = s2 * p + d3 * p - k * s3;
+		d3 = s2;
+	
+		// Clipping band-limited sigmoid
+		s3 -= (s3 * s3 * s3) / 6.0;
+
+		if (WriteTaps)
+		{
+			float * t = out + s * NUM_TAPS;
+			t[0] = x;
+			t[1] = s0 * tapGain[1];
+			t[2] = s1 * tapGain[2];
+			t[3] = s2 * tapGain[3];
+			t[4] = s3 * tapGain[4];
+		}
+		else if (lp4)
+		{
+			out[s] = s3;
+		}
+		else
+		{
+			out[s] = outputMix[0] * x + outputMix[1] * s0 + outputMix[2] * s1 + outputMix[3] * s2 + outputMix[4] * s3;
+		}
+	}
+
+	st.stage[0] = s0; st.stage[1] = s1; st.stage[2] = s2; st.stage[3] = s3;
+	st.delay[0] = d0; st.delay[1] = d1; st.delay[2] = d2; st.delay[3] = d3;
+}
+
+inline void moog_process(const MusicDSPCoeffs & c, MusicDSPState & s, float * samples, uint32_t n)
+{
+	moog_musicdsp_run<false>(c, s, samples, samples, n);
+}
+
+// Writes NUM_TAPS values per sample: the input after feedback and the four
+// stage outputs, normalized to unity DC gain per stage the same way Process
+// weights them, so LadderFilterBase::MixTaps gives the same responses. The one
+// exception is LP4, which Process leaves at the original code's level.
+inline void moog_process_taps(const MusicDSPCoeffs & c, MusicDSPState & s, const float * input, float * taps, uint32_t n)
+{
+	moog_musicdsp_run<true>(c, s, input, taps, n);
+}
+
+class MusicDSPMoog : public LadderModel<MusicDSPCoeffs, MusicDSPState>
+{
+	
+public:
+	
+	MusicDSPMoog(float sampleRate) : LadderModel(sampleRate)
+	{
+		state.Init();
+		resonance = 0.0f;
 		SetCutoff(1000.0f);
 		SetResonance(0.10f);
 	}
@@ -31,55 +160,170 @@ public:
 	
 	virtual void Process(float * samples, uint32_t n) override
 	{
-		for (int s = 0; s < n; ++s)
-		{
-			float x = samples[s] - resonance * stage[3];
-
-			// Four cascaded one-pole filters (bilinear transform)
-			stage[0] = x * p + delay[0]  * p - k * stage[0];
-			stage[1] = stage[0] * p + delay[1] * p - k * stage[1];
-			stage[2] = stage[1] * p + delay[2] * p - k * stage[2];
-			stage[3] = stage[2] * p + delay[3] * p - k * stage[3];
-		
-			// Clipping band-limited sigmoid
-			stage[3] -= (stage[3] * stage[3] * stage[3]) / 6.0;
-			
-			delay[0] = x;
-			delay[1] = stage[0];
-			delay[2] = stage[1];
-			delay[3] = stage[2];
-
-			samples[s] = stage[3];
-		}
+		moog_process(coeffs.Get(), state, samples, n);
+	}
+	
+	void ProcessTaps(const float * input, float * taps, uint32_t n)
+	{
+		moog_process_taps(coeffs.Get(), state, input, taps, n);
+	}
+	
+	virtual bool SetOutputMode(OutputMode m) override
+	{
+		outputMode = m;
+		state.outputMode = m;
+		return true;
 	}
 	
 	virtual void SetResonance(float r) override
 	{
-		resonance = r * (t2 + 6.0 * t1) / (t2 - 6.0 * t1);
+		resonance = r;
+		coeffs.Edit().SetResonance(r);
 	}
 	
 	virtual void SetCutoff(float c) override
 	{
-		cutoff = 2.0 * c / sampleRate;
+		cutoff = c;
+		coeffs.Edit().SetCutoff(sampleRate, c);
+	}
+};
+
+/*
+Block processing of many MusicDSP voices at once, one voice per SIMD lane.
+State is copied into locals for the duration of a block so it can stay in
+registers. The second Process overload takes a per-sample, per-voice cutoff in
+Hertz (same layout as the samples) and derives the coefficients inline with a
+polynomial sin instead of calling SetCutoff. Samples are interleaved by voice:
+samples[frame * Voices + voice].
+*/
+
+template <int Voices>
+class MusicDSPMoogBank
+{
+	NO_COPY(MusicDSPMoogBank);
 
-		p = cutoff * (1.8 - 0.8 * cutoff);
-		k = 2.0 * sin(cutoff * MOOG_PI * 0.5) - 1.0;
-		t1 = (1.0 - p) * 1.386249;
-		t2 = 12.0 + t1 * t1;
+public:
 
-		SetResonance(resonance);
+	MusicDSPMoogBank(float sampleRate) : sampleRate(sampleRate)
+	{
+		memset(stage, 0, sizeof(stage));
+		memset(delay, 0, sizeof(delay));
+		memset(resonance, 0, sizeof(resonance));
+		for (int v = 0; v < Voices; ++v)
+		{
+			SetCutoff(v, 1000.0f);
+			SetResonance(v, 0.10f);
+		}
 	}
-	
+
+	void Process(float * samples, uint32_t n)
+	{
+		alignas(32) double s[4][Voices];
+		alignas(32) double d[4][Voices];
+		memcpy(s, stage, sizeof(s));
+		memcpy(d, delay, sizeof(d));
+
+		for (int i = 0; i < n; ++i)
+		{
+			float * frame = samples + i * Voices;
+			for (int v = 0; v < Voices; ++v)
+			{
+				Tick(frame[v], v, p[v], k[v], feedback[v], s, d);
+			}
+		}
+
+		memcpy(stage, s, sizeof(s));
+		memcpy(delay, d, sizeof(d));
+	}
+
+	void Process(float * samples, const float * cutoffs, uint32_t n)
+	{
+		alignas(32) double s[4][Voices];
+		alignas(32) double d[4][Voices];
+		memcpy(s, stage, sizeof(s));
+		memcpy(d, delay, sizeof(d));
+
+		const double nyquistInv = 2.0 / sampleRate;
+
+		for (int i = 0; i < n; ++i)
+		{
+			float * frame = samples + i * Voices;
+			const float * fc = cutoffs + i * Voices;
+			for (int v = 0; v < Voices; ++v)
+			{
+				const double c = fc[v] * nyquistInv;
+				const double pv = c * (1.8 - 0.8 * c);
+				const double kv = 2.0 * fast_sin(c * MOOG_PI * 0.5) - 1.0;
+				const double t1 = (1.0 - pv) * 1.386249;
+				const double t2 = 12.0 + t1 * t1;
+				const double fb = resonance[v] * (t2 + 6.0 * t1) / (t2 - 6.0 * t1);
+				Tick(frame[v], v, pv, kv, fb, s, d);
+			}
+		}
+
+		memcpy(stage, s, sizeof(s));
+		memcpy(delay, d, sizeof(d));
+
+		// Leave the coefficients at the last cutoff of the block
+		for (int v = 0; v < Voices; ++v)
+		{
+			if (n) SetCutoff(v, cutoffs[(n - 1) * Voices + v]);
+		}
+	}
+
+	void SetResonance(int voice, float r)
+	{
+		resonance[voice] = r;
+		feedback[voice] = r * resonanceScale[voice];
+	}
+
+	void SetCutoff(int voice, float c)
+	{
+		cutoff[voice] = c;
+
+		const double fc = 2.0 * c / sampleRate;
+		p[voice] = fc * (1.8 - 0.8 * fc);
+		k[voice] = 2.0 * sin(fc * MOOG_PI * 0.5) - 1.0;
+
+		const double t1 = (1.0 - p[voice]) * 1.386249;
+		const double t2 = 12.0 + t1 * t1;
+		resonanceScale[voice] = (t2 + 6.0 * t1) / (t2 - 6.0 * t1);
+		feedback[voice] = resonance[voice] * resonanceScale[voice];
+	}
+
+	float GetResonance(int voice) const { return resonance[voice]; }
+	float GetCutoff(int voice) const { return cutoff[voice]; }
+
 private:
-	
-	double stage[4];
-	double delay[4];
 
-	double p;
-	double k;
-	double t1;
-	double t2;
+	static inline void Tick(float & sample, int v, double p, double k, double fb, double (&s)[4][Voices], double (&d)[4][Voices])
+	{
+		const float x = sample - fb * s[3][v];
+
+		s[0][v] = x * p + d[0][v] * p - k * s[0][v];
+		d[0][v] = x;
+		s[1][v] = s[0][v] * p + d[1][v] * p - k * s[1][v];
+		d[1][v] = s[0][v];
+		s[2][v] = s[1][v] * p + d[2][v] * p - k * s[2][v];
+		d[2][v] = s[1][v];
+		s[3][v] = s[2][v] * p + d[3][v] * p - k * s[3][v];
+		d[3][v] = s[2][v];
+
+		s[3][v] -= (s[3][v] * s[3][v] * s[3][v]) / 6.0;
+		sample = s[3][v];
+	}
+
+	alignas(32) double stage[4][Voices];
+	alignas(32) double delay[4][Voices];
+
+	alignas(32) double p[Voices];
+	alignas(32) double k[Voices];
+	alignas(32) double resonanceScale[Voices];
+	alignas(32) double feedback[Voices];
 
+	float cutoff[Voices];
+	float resonance[Voices];
+	float sampleRate;
 };
 
 #endif
@@ -7,71 +7,154 @@
 #ifndef OBERHEIM_VARIATION_LADDER_H
 #define OBERHEIM_VARIATION_LADDER_H
 
+#include "CoefficientCache.h"
 #include "LadderFilterBase.h"
 #include "Util.h"
 
-class VAOnePole
-{
-public:
+#include <string.h>
 
-	VAOnePole(float sr) : sampleRate(sr)
+struct OberheimVariationCoeffs
+{
+	void SetCutoff(float sampleRate, float c)
 	{
-		Reset();
+		cutoff = c;
+		
+		// prewarp for BZT
+		double wd = 2.0 * MOOG_PI * cutoff;
+		double T = 1.0 / sampleRate;
+		double wa = (2.0 / T) * tan(wd * T / 2.0);
+		double g = wa * T / 2.0;
+		
+		// Feedforward coeff
+		G = g / (1.0 + g);
+		
+		beta[0] = G*G*G / (1.0 + g);
+		beta[1] = G*G / (1.0 + g);
+		beta[2] = G / (1.0 + g);
+		beta[3] = 1.0 / (1.0 + g);
+		
+		gamma = G*G*G*G;
+		alpha0 = 1.0 / (1.0 + K * gamma);
 	}
 	
-	void Reset()
+	void SetResonance(float r)
 	{
-		alpha = 1.0;
-		beta = 0.0;
-		gamma = 1.0;
-		delta = 0.0;
-		epsilon = 0.0;
-		a0 = 1.0;
-		feedback = 0.0;
-		z1 = 0.0;
+		resonance = r;
+		Q = r;
+		
+		// this maps resonance = 1->10 to K = 0 -> 4
+		K = (4.0) * (r - 1.0)/(10.0 - 1.0);
+		alpha0 = 1.0 / (1.0 + K * gamma);
 	}
 	
-	double Tick(double s)
+	float cutoff;
+	float resonance;
+	double G; // alpha of every one-pole
+	double beta[4]; // feedback output gain of each one-pole
+	double K;
+	double gamma;
+	double alpha0;
+	double Q;
+};
+
+// The four virtual analog one-poles are reduced to their integrator states;
+// their input gain, feedback and delta terms are constant (1 and 0) in this
+// variation
+struct OberheimVariationState
+{
+	void Init()
 	{
-		s = s * gamma + feedback + epsilon * GetFeedbackOutput();
-		double vn = (a0 * s - z1) * alpha;
-		double out = vn + z1;
-		z1 = vn + out;
-		return out;
+		memset(z1, 0, sizeof(z1));
+		saturation = 1.0;
+		outputMode = LadderFilterBase::LP4;
 	}
 	
-	void SetFeedback(double fb) { feedback = fb; }
-	double GetFeedbackOutput(){ return beta * (z1 + feedback * delta); }
-	void SetAlpha(double a) { alpha = a; };
-	void SetBeta(double b) { beta = b; };
+	double z1[4];
+	double saturation;
+	LadderFilterBase::OutputMode outputMode;
+};
+
+template <bool WriteTaps>
+inline void moog_oberheim_run(const OberheimVariationCoeffs & c, OberheimVariationState & st, const float * in, float * out, uint32_t n) noexcept
+{
+	const int NUM_TAPS = LadderFilterBase::NUM_TAPS;
+	const double K = c.K;
+	const double alpha0 = c.alpha0;
+	const double alpha = c.G;
+	double * z1 = st.z1;
+	
+	double outputMix[NUM_TAPS];
+	LadderFilterBase::GetOutputModeWeights(st.outputMode, outputMix);
 	
-private:
+	for (int s = 0; s < n; ++s)
+	{
+		float input = in[s];
+		
+		double sigma =
+			c.beta[0] * z1[0] +
+			c.beta[1] * z1[1] +
+			c.beta[2] * z1[2] +
+			c.beta[3] * z1[3];
+		
+		input *= 1.0 + K;
+		
+		// calculate input to first filter
+		double u = (input - K * sigma) * alpha0;
+		
+		u = tanh(st.saturation * u);
+		
+		double stages[4];
+		double x = u;
+		for (int i = 0; i < 4; ++i)
+		{
+			const double vn = (x - z1[i]) * alpha;
+			x = vn + z1[i];
+			z1[i] = vn + x;
+			stages[i] = x;
+		}
+		
+		if (WriteTaps)
+		{
+			float * t = out + s * NUM_TAPS;
+			t[0] = u;
+			t[1] = stages[0];
+			t[2] = stages[1];
+			t[3] = stages[2];
+			t[4] = stages[3];
+		}
+		else
+		{
+			// Oberheim variations
+			out[s] =
+				outputMix[0] * u +
+				outputMix[1] * stages[0] +
+				outputMix[2] * stages[1] +
+				outputMix[3] * stages[2] +
+				outputMix[4] * stages[3];
+		}
+	}
+}
 
-	float sampleRate;
-	double alpha;
-	double beta;
-	double gamma;
-	double delta;
-	double epsilon;
-	double a0;
-	double feedback;
-	double z1;
-};
+inline void moog_process(const OberheimVariationCoeffs & c, OberheimVariationState & s, float * samples, uint32_t n) noexcept
+{
+	moog_oberheim_run<false>(c, s, samples, samples, n);
+}
+
+// Writes NUM_TAPS values per sample: the saturated input to the first filter
+// and the four stage outputs. See LadderFilterBase::MixTaps.
+inline void moog_process_taps(const OberheimVariationCoeffs & c, OberheimVariationState & s, const float * input, float * taps, uint32_t n) noexcept
+{
+	moog_oberheim_run<true>(c, s, input, taps, n);
+}
 
-class OberheimVariationMoog : public LadderFilterBase
+class OberheimVariationMoog : public LadderModel<OberheimVariationCoeffs, OberheimVariationState>
 {
 	
 public:
 	
-	OberheimVariationMoog(float sampleRate) : LadderFilterBase(sampleRate)
+	OberheimVariationMoog(float sampleRate) : LadderModel(sampleRate)
 	{
-		LPF1 = new VAOnePole(sampleRate);
-		LPF2 = new VAOnePole(sampleRate);
-		LPF3 = new VAOnePole(sampleRate);
-		LPF4 = new VAOnePole(sampleRate);
-		
-		saturation = 1.0;
-		Q = 3.0;
+		state.Init();
 		
 		SetCutoff(1000.f);
 		SetResonance(0.1f);
@@ -79,100 +162,57 @@ public:
 	
 	virtual ~OberheimVariationMoog()
 	{
-		delete LPF1;
-		delete LPF2;
-		delete LPF3;
-		delete LPF4;
 	}
 	
 	virtual void Process(float * samples, uint32_t n) noexcept override
 	{
-		for (int s = 0; s < n; ++s)
+		moog_process(coeffs.Get(), state, samples, n);
+	}
+	
+	void ProcessTaps(const float * input, float * taps, uint32_t n) noexcept
+	{
+		moog_process_taps(coeffs.Get(), state, input, taps, n);
+	}
+	
+	virtual bool SetOutputMode(OutputMode m) override
+	{
+		outputMode = m;
+		state.outputMode = m;
+		return true;
+	}
+	
+	// Q is the resonance on Pirkle's 1 -> 10 scale, so both map onto K
+	virtual bool SetParameter(Parameter p, float value) override
+	{
+		switch (p)
 		{
-			float input = samples[s];
-			
-			double sigma =
-				LPF1->GetFeedbackOutput() +
-				LPF2->GetFeedbackOutput() +
-				LPF3->GetFeedbackOutput() +
-				LPF4->GetFeedbackOutput();
-			
-			input *= 1.0 + K;
-			
-			// calculate input to first filter
-			double u = (input - K * sigma) * alpha0;
-			
-			u = tanh(saturation * u);
-			
-			double stage1 = LPF1->Tick(u);
-			double stage2 = LPF2->Tick(stage1);
-			double stage3 = LPF3->Tick(stage2);
-			double stage4 = LPF4->Tick(stage3);
-			
-			// Oberheim variations
-			samples[s] =
-				oberheimCoefs[0] * u +
-				oberheimCoefs[1] * stage1 +
-				oberheimCoefs[2] * stage2 +
-				oberheimCoefs[3] * stage3 +
-				oberheimCoefs[4] * stage4;
+			case SATURATION: state.saturation = value; return true;
+			case Q_FACTOR: SetResonance(value); return true;
+			default: return false;
+		}
+	}
+	
+	virtual bool GetParameter(Parameter p, float & value) override
+	{
+		switch (p)
+		{
+			case SATURATION: value = state.saturation; return true;
+			case Q_FACTOR: value = coeffs.Get().Q; return true;
+			default: return false;
 		}
 	}
 	
 	virtual void SetResonance(float r) override
-        {
-             // this maps resonance = 1->10 to K = 0 -> 4
-             K = (4.0) * (r - 1.0)/(10.0 - 1.0);
-        }
+	{
+		resonance = r;
+		coeffs.Edit().SetResonance(r);
+	}
 
 	virtual void SetCutoff(float c) override
 	{
 		cutoff = c;
-		
-		// prewarp for BZT
-		double wd = 2.0 * MOOG_PI * cutoff;
-		double T = 1.0 / sampleRate;
-		double wa = (2.0 / T) * tan(wd * T / 2.0);
-		double g = wa * T / 2.0;
-		
-		// Feedforward coeff
-		double G = g / (1.0 + g);
-		
-		LPF1->SetAlpha(G);
-		LPF2->SetAlpha(G);
-		LPF3->SetAlpha(G);
-		LPF4->SetAlpha(G);
-
-		LPF1->SetBeta(G*G*G / (1.0 + g));
-		LPF2->SetBeta(G*G / (1.0 + g));
-		LPF3->SetBeta(G / (1.0 + g));
-		LPF4->SetBeta(1.0 / (1.0 + g));
-		
-		gamma = G*G*G*G;
-		alpha0 = 1.0 / (1.0 + K * gamma);
-		
-		// Oberheim variations / LPF4
-		oberheimCoefs[0] = 0.0;
-		oberheimCoefs[1] = 0.0;
-		oberheimCoefs[2] = 0.0;
-		oberheimCoefs[3] = 0.0;
-		oberheimCoefs[4] = 1.0;
+		coeffs.Edit().SetCutoff(sampleRate, c);
 	}
-	
-private:
-	
-	VAOnePole * LPF1;
-	VAOnePole * LPF2;
-	VAOnePole * LPF3;
-	VAOnePole * LPF4;
-	
-	double K;
-	double gamma;
-	double alpha0;
-	double Q;
-	double saturation;
-	
-	double oberheimCoefs[5];
 };
 
 #endif
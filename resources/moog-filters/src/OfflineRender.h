@@ -0,0 +1,193 @@
+#pragma once
+
+#ifndef OFFLINE_RENDER_H
+#define OFFLINE_RENDER_H
+
+#include "Filters.h"
+#include "LadderFilterBase.h"
+
+#include <algorithm>
+#include <functional>
+#include <memory>
+#include <thread>
+#include <vector>
+
+/*
+Parallel-in-time rendering of long offline buffers. The buffer is cut into one
+chunk per thread and the chunks are filtered concurrently.
+
+Linear filters (BiQuadBase and RBJFilter) are spliced exactly. Every chunk is
+first rendered from a zero state, which yields its zero-state output and end
+state. A scan over the chunks then propagates the true start state of each one
+through the state-transition matrix A^L (s[c+1] = A^L * s[c] + z[c]), and a
+second parallel pass adds the zero-input response of that start state. The
+result matches a serial pass up to float rounding and leaves the filter in the
+same state.
+
+Nonlinear models have no such superposition, so each chunk is instead warmed
+up on the `warmup` samples preceding it in a fresh filter instance. Every chunk
+also renders `probe` samples past its end; comparing those against the start of
+the following chunk gives the remaining convergence error at each seam.
+*/
+
+struct OfflineRenderReport
+{
+	int chunks = 0;
+	float maxSeamError = 0.0f; // max abs difference over the probe window, 0 for exact splicing
+	std::vector<float> seamErrors; // one per chunk boundary
+};
+
+template <typename F>
+inline void moog_parallel_chunks(int chunks, F && fn)
+{
+	std::vector<std::thread> workers;
+	workers.reserve(chunks - 1);
+	for (int c = 1; c < chunks; ++c) workers.emplace_back(fn, c);
+	fn(0);
+	for (auto & w : workers) w.join();
+}
+
+inline size_t moog_chunk_start(size_t n, int chunks, int c)
+{
+	return n * c / chunks;
+}
+
+// 2x2 transition matrix of the DF-II transposed biquad under zero input
+struct StateMatrix2
+{
+	double m[2][2];
+
+	StateMatrix2 operator * (const StateMatrix2 & o) const
+	{
+		StateMatrix2 r;
+		for (int i = 0; i < 2; ++i)
+			for (int j = 0; j < 2; ++j)
+				r.m[i][j] = m[i][0] * o.m[0][j] + m[i][1] * o.m[1][j];
+		return r;
+	}
+
+	static StateMatrix2 Power(StateMatrix2 a, size_t e)
+	{
+		StateMatrix2 r = {{{1.0, 0.0}, {0.0, 1.0}}};
+		while (e)
+		{
+			if (e & 1) r = r * a;
+			a = a * a;
+			e >>= 1;
+		}
+		return r;
+	}
+};
+
+inline OfflineRenderReport ProcessParallel(BiQuadBase & filter, float * samples, size_t n, int threads = std::thread::hardware_concurrency())
+{
+	OfflineRenderReport report;
+	report.chunks = (int) std::max<size_t>(1, std::min<size_t>(std::max(threads, 1), n / 1024));
+
+	const int chunks = report.chunks;
+	const std::array<float, 3> b = filter.GetBCoefs();
+	const std::array<float, 2> a = filter.GetACoefs();
+
+	std::vector<std::array<float, 2>> endState(chunks);
+
+	// Zero-state responses. The first chunk starts from the filter's real state.
+	moog_parallel_chunks(chunks, [&](int c)
+	{
+		BiQuadBase local;
+		local.SetBiquadCoefs(b, a);
+		if (c == 0) local.SetState(filter.GetState());
+
+		const size_t start = moog_chunk_start(n, chunks, c);
+		local.Process(samples + start, (uint32_t) (moog_chunk_start(n, chunks, c + 1) - start));
+		endState[c] = local.GetState();
+	});
+
+	// Prefix scan of the per-chunk affine state maps
+	const StateMatrix2 A = {{{-a[0], 1.0}, {-a[1], 0.0}}};
+	std::vector<std::array<double, 2>> startState(chunks + 1);
+	startState[1] = {{endState[0][0], endState[0][1]}};
+
+	for (int c = 1; c < chunks; ++c)
+	{
+		const StateMatrix2 AL = StateMatrix2::Power(A, moog_chunk_start(n, chunks, c + 1) - moog_chunk_start(n, chunks, c));
+		const std::array<double, 2> & s = startState[c];
+		startState[c + 1][0] = AL.m[0][0] * s[0] + AL.m[0][1] * s[1] + endState[c][0];
+		startState[c + 1][1] = AL.m[1][0] * s[0] + AL.m[1][1] * s[1] + endState[c][1];
+	}
+
+	// Zero-input responses of the true start states
+	if (chunks > 1)
+	{
+		moog_parallel_chunks(chunks - 1, [&](int i)
+		{
+			const int c = i + 1;
+			double w0 = startState[c][0], w1 = startState[c][1];
+
+			const size_t start = moog_chunk_start(n, chunks, c);
+			const size_t end = moog_chunk_start(n, chunks, c + 1);
+			for (size_t s = start; s < end && (w0 != 0.0 || w1 != 0.0); ++s)
+			{
+				samples[s] += (float) w0;
+				const double next = -a[0] * w0 + w1;
+				w1 = -a[1] * w0;
+				w0 = next;
+				SNAP_TO_ZERO(w0);
+				SNAP_TO_ZERO(w1);
+			}
+		});
+	}
+
+	filter.SetState({{(float) startState[chunks][0], (float) startState[chunks][1]}});
+	return report;
+}
+
+// `make` must return a filter configured like the one a serial render would use
+inline OfflineRenderReport ProcessParallel(const std::function<std::unique_ptr<LadderFilterBase>()> & make, float * samples, size_t n, size_t warmup = 4096, size_t probe = 256, int threads = std::thread::hardware_concurrency())
+{
+	OfflineRenderReport report;
+	report.chunks = (int) std::max<size_t>(1, std::min<size_t>(std::max(threads, 1), n / std::max<size_t>(warmup + probe, 1024)));
+
+	const int chunks = report.chunks;
+	const std::vector<float> input(samples, samples + n);
+	std::vector<std::vector<float>> tails(chunks);
+
+	moog_parallel_chunks(chunks, [&](int c)
+	{
+		std::unique_ptr<LadderFilterBase> filter = make();
+
+		const size_t start = moog_chunk_start(n, chunks, c);
+		const size_t end = moog_chunk_start(n, chunks, c + 1);
+
+		if (c > 0)
+		{
+			const size_t from = start > warmup ? start - warmup : 0;
+			std::vector<float> scratch(input.begin() + from, input.begin() + start);
+			filter->Process(scratch.data(), (uint32_t) scratch.size());
+		}
+
+		std::copy(input.begin() + start, input.begin() + end, samples + start);
+		filter->Process(samples + start, (uint32_t) (end - start));
+
+		if (c + 1 < chunks)
+		{
+			tails[c].assign(input.begin() + end, input.begin() + std::min(end + probe, n));
+			filter->Process(tails[c].data(), (uint32_t) tails[c].size());
+		}
+	});
+
+	for (int c = 0; c + 1 < chunks; ++c)
+	{
+		const size_t next = moog_chunk_start(n, chunks, c + 1);
+		float err = 0.0f;
+		for (size_t s = 0; s < tails[c].size(); ++s)
+		{
+			err = std::max(err, fabsf(tails[c][s] - samples[next + s]));
+		}
+		report.seamErrors.push_back(err);
+		report.maxSeamError = std::max(report.maxSeamError, err);
+	}
+
+	return report;
+}
+
+#endif
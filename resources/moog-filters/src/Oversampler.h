@@ -0,0 +1,368 @@
+#pragma once
+
+#ifndef OVERSAMPLER_H
+#define OVERSAMPLER_H
+
+#include "Util.h"
+
+#include "HalfBandDesign.h"
+
+#include <array>
+#include <type_traits>
+#include <vector>
+#include <string.h>
+
+/*
+Power-of-two oversampling for the nonlinear ladder models. Each 2x stage is a
+half-band lowpass from HalfBandDesign.h, split into its two polyphase branches
+so no work is spent on the zero-stuffed samples. Stages are cascaded for 4x
+and 8x.
+
+HALFBAND_LINEAR_PHASE stages are Kaiser-windowed FIRs. Every other tap of a
+half-band FIR is zero, so one branch is a pure delay and the other holds all of
+the nonzero taps, which halves the work compared to filtering the zero-stuffed
+signal. HALFBAND_MINIMUM_PHASE stages are allpass-pair IIRs, where each branch
+is a short chain of first-order allpass sections; they are much cheaper for the
+same attenuation but not linear phase.
+
+All classes process several independent lanes (voices) at once. Lane data is
+stored contiguously so the inner loops vectorize across lanes.
+*/
+
+enum HalfBandType
+{
+	HALFBAND_LINEAR_PHASE,
+	HALFBAND_MINIMUM_PHASE
+};
+
+// Transition widths of the built-in designs, as a fraction of the oversampled
+// rate: both pass up to 0.2 (0.4 of the base rate)
+static const double HALFBAND_FIR_TRANSITION = 0.1;
+static const double HALFBAND_IIR_TRANSITION = 0.1;
+
+// Nonzero taps of a half-band lowpass with 2 * Taps - 1 points, DC gain of 1,
+// stored in reverse for the polyphase kernels. Taps must be even. The center
+// tap (0.5) is implicit. The attenuation is whatever Taps allows at
+// HALFBAND_FIR_TRANSITION, about 97 dB for 32 taps.
+template <int Taps>
+struct HalfBandCoefficients
+{
+	static_assert(Taps > 0 && (Taps % 2) == 0, "Taps must be a positive even number");
+
+	HalfBandCoefficients()
+	{
+		attenuation = 14.36 * HALFBAND_FIR_TRANSITION * (2 * Taps - 2) + 7.95;
+		const std::vector<float> h = moog_design_halfband_fir(Taps, attenuation);
+		for (int i = 0; i < Taps; ++i) reversed[i] = h[Taps - 1 - i];
+	}
+
+	alignas(32) std::array<float, Taps> reversed;
+	double attenuation;
+};
+
+// Allpass coefficients of a minimum-phase half-band at HALFBAND_IIR_TRANSITION
+template <int Coefs>
+struct AllpassHalfBandCoefficients
+{
+	static_assert(Coefs > 0, "At least one allpass coefficient is needed");
+
+	AllpassHalfBandCoefficients()
+	{
+		const std::vector<double> c = moog_design_halfband_iir(Coefs, HALFBAND_IIR_TRANSITION);
+		for (int i = 0; i < Coefs; ++i) coefs[i] = (float) c[i];
+		attenuation = moog_halfband_iir_attenuation(Coefs, HALFBAND_IIR_TRANSITION);
+
+		// Each section (a + z^-2) / (1 + a z^-2) delays DC by 2 (1 - a) / (1 + a)
+		// samples. A stage delays by the mean of its two branches, give or take
+		// a half-sample offset that the matching stage cancels out.
+		delay = 0.0f;
+		for (float a : coefs) delay += (1.0f - a) / (1.0f + a);
+	}
+
+	std::array<float, Coefs> coefs;
+	double attenuation;
+	float delay; // at DC, in oversampled samples
+};
+
+// Interpolates one sample per lane into two
+template <int Taps, int Lanes = 1>
+class HalfBandUpsampler
+{
+public:
+
+	HalfBandUpsampler() { Reset(); }
+
+	// In oversampled samples
+	float GetDelay() const { return Taps - 1; }
+
+	void Reset()
+	{
+		memset(history, 0, sizeof(history));
+		pos = 0;
+	}
+
+	// out holds two frames of Lanes samples each
+	void Process(const float * in, float * out)
+	{
+		for (int v = 0; v < Lanes; ++v)
+		{
+			history[pos][v] = history[pos + Taps][v] = in[v];
+		}
+		pos = (pos + 1) % Taps;
+
+		// history[pos + Taps - 1] is the newest sample, history[pos] the oldest
+		moog_halfband_dot<Lanes>(h.reversed.data(), &history[pos][0], Taps, out);
+
+		for (int v = 0; v < Lanes; ++v)
+		{
+			out[v] *= 2.0f;
+			out[Lanes + v] = history[pos + Taps / 2][v];
+		}
+	}
+
+private:
+
+	HalfBandCoefficients<Taps> h; // designed once, on construction
+	alignas(32) float history[2 * Taps][Lanes];
+	int pos;
+};
+
+// Filters and drops every other sample
+template <int Taps, int Lanes = 1>
+class HalfBandDownsampler
+{
+public:
+
+	HalfBandDownsampler() { Reset(); }
+
+	// In oversampled samples
+	float GetDelay() const { return Taps - 1; }
+
+	void Reset()
+	{
+		memset(even, 0, sizeof(even));
+		memset(odd, 0, sizeof(odd));
+		pos = 0;
+	}
+
+	// in holds two frames of Lanes samples each
+	void Process(const float * in, float * out)
+	{
+		for (int v = 0; v < Lanes; ++v)
+		{
+			even[pos][v] = even[pos + Taps][v] = in[v];
+			odd[pos][v] = odd[pos + Taps][v] = in[Lanes + v];
+		}
+		pos = (pos + 1) % Taps;
+
+		moog_halfband_dot<Lanes>(h.reversed.data(), &even[pos][0], Taps, out);
+
+		for (int v = 0; v < Lanes; ++v)
+		{
+			out[v] += 0.5f * odd[pos + Taps / 2 - 1][v];
+		}
+	}
+
+private:
+
+	HalfBandCoefficients<Taps> h; // designed once, on construction
+	alignas(32) float even[2 * Taps][Lanes];
+	alignas(32) float odd[2 * Taps][Lanes];
+	int pos;
+};
+
+// Minimum-phase interpolator: the two allpass chains produce the two output
+// phases directly
+template <int Coefs, int Lanes = 1>
+class AllpassHalfBandUpsampler
+{
+public:
+
+	AllpassHalfBandUpsampler() { Reset(); }
+
+	// In oversampled samples
+	float GetDelay() const { return h.delay; }
+
+	void Reset()
+	{
+		memset(x1, 0, sizeof(x1));
+		memset(y1, 0, sizeof(y1));
+	}
+
+	// out holds two frames of Lanes samples each
+	void Process(const float * in, float * out)
+	{
+		float path[2][Lanes];
+		for (int v = 0; v < Lanes; ++v) path[0][v] = path[1][v] = in[v];
+
+		for (int c = 0; c < Coefs; ++c)
+		{
+			float * x = path[c & 1];
+			const float a = h.coefs[c];
+			for (int v = 0; v < Lanes; ++v)
+			{
+				const float y = a * (x[v] - y1[c][v]) + x1[c][v];
+				x1[c][v] = x[v];
+				y1[c][v] = y;
+				x[v] = y;
+			}
+		}
+
+		for (int v = 0; v < Lanes; ++v)
+		{
+			out[v] = path[0][v];
+			out[Lanes + v] = path[1][v];
+		}
+	}
+
+private:
+
+	AllpassHalfBandCoefficients<Coefs> h; // designed once, on construction
+	alignas(32) float x1[Coefs][Lanes];
+	alignas(32) float y1[Coefs][Lanes];
+};
+
+// Minimum-phase decimator: each input phase runs through one allpass chain
+// and the two are averaged
+template <int Coefs, int Lanes = 1>
+class AllpassHalfBandDownsampler
+{
+public:
+
+	AllpassHalfBandDownsampler() { Reset(); }
+
+	// In oversampled samples
+	float GetDelay() const { return h.delay; }
+
+	void Reset()
+	{
+		memset(x1, 0, sizeof(x1));
+		memset(y1, 0, sizeof(y1));
+	}
+
+	// in holds two frames of Lanes samples each
+	void Process(const float * in, float * out)
+	{
+		float path[2][Lanes];
+		for (int v = 0; v < Lanes; ++v)
+		{
+			path[0][v] = in[Lanes + v];
+			path[1][v] = in[v];
+		}
+
+		for (int c = 0; c < Coefs; ++c)
+		{
+			float * x = path[c & 1];
+			const float a = h.coefs[c];
+			for (int v = 0; v < Lanes; ++v)
+			{
+				const float y = a * (x[v] - y1[c][v]) + x1[c][v];
+				x1[c][v] = x[v];
+				y1[c][v] = y;
+				x[v] = y;
+			}
+		}
+
+		for (int v = 0; v < Lanes; ++v)
+		{
+			out[v] = 0.5f * (path[0][v] + path[1][v]);
+		}
+	}
+
+private:
+
+	AllpassHalfBandCoefficients<Coefs> h; // designed once, on construction
+	alignas(32) float x1[Coefs][Lanes];
+	alignas(32) float y1[Coefs][Lanes];
+};
+
+// Cascade of 2x stages. Factor must be 1, 2, 4 or 8. Taps is the number of
+// nonzero FIR taps for HALFBAND_LINEAR_PHASE, or of allpass coefficients for
+// HALFBAND_MINIMUM_PHASE (6 give about 100 dB).
+template <int Factor, int Lanes = 1, int Taps = 32, HalfBandType Type = HALFBAND_LINEAR_PHASE>
+class Oversampler
+{
+	static_assert(Factor == 1 || Factor == 2 || Factor == 4 || Factor == 8, "Unsupported oversampling factor");
+
+	static const int Stages = Factor == 8 ? 3 : Factor == 4 ? 2 : Factor == 2 ? 1 : 0;
+	static const bool Linear = Type == HALFBAND_LINEAR_PHASE;
+
+	typedef typename std::conditional<Linear, HalfBandUpsampler<Taps, Lanes>, AllpassHalfBandUpsampler<Taps, Lanes>>::type Upsampler;
+	typedef typename std::conditional<Linear, HalfBandDownsampler<Taps, Lanes>, AllpassHalfBandDownsampler<Taps, Lanes>>::type Downsampler;
+
+public:
+
+	void Reset()
+	{
+		for (auto & u : up) u.Reset();
+		for (auto & d : down) d.Reset();
+	}
+
+	// One frame of Lanes samples in, Factor frames out
+	void Upsample(const float * in, float * out)
+	{
+		float a[Factor * Lanes];
+		float b[Factor * Lanes];
+		float * src = a;
+		float * dst = b;
+
+		memcpy(src, in, Lanes * sizeof(float));
+
+		int frames = 1;
+		for (int stage = 0; stage < Stages; ++stage)
+		{
+			for (int f = 0; f < frames; ++f)
+			{
+				up[stage].Process(src + f * Lanes, dst + 2 * f * Lanes);
+			}
+			frames *= 2;
+			float * t = src; src = dst; dst = t;
+		}
+
+		memcpy(out, src, Factor * Lanes * sizeof(float));
+	}
+
+	// Factor frames in, one frame of Lanes samples out
+	void Downsample(const float * in, float * out)
+	{
+		float a[Factor * Lanes];
+		float b[Factor * Lanes];
+		float * src = a;
+		float * dst = b;
+
+		memcpy(src, in, Factor * Lanes * sizeof(float));
+
+		int frames = Factor;
+		for (int stage = Stages - 1; stage >= 0; --stage)
+		{
+			frames /= 2;
+			for (int f = 0; f < frames; ++f)
+			{
+				down[stage].Process(src + 2 * f * Lanes, dst + f * Lanes);
+			}
+			float * t = src; src = dst; dst = t;
+		}
+
+		memcpy(out, src, Lanes * sizeof(float));
+	}
+
+	// Round-trip delay in samples at the base rate. For minimum-phase stages
+	// this is the group delay at DC; it grows towards the band edge.
+	float GetLatency() const
+	{
+		float latency = 0.0f;
+		float rate = 0.5f;
+		for (int stage = 0; stage < Stages; ++stage, rate *= 0.5f)
+		{
+			latency += (up[stage].GetDelay() + down[stage].GetDelay()) * rate;
+		}
+		return latency;
+	}
+
+private:
+
+	std::array<Upsampler, Stages> up;
+	std::array<Downsampler, Stages> down;
+};
+
+#endif
@@ -28,9 +28,12 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #ifndef RK_SIMULATION_LADDER_H
 #define RK_SIMULATION_LADDER_H
 
+#include "CoefficientCache.h"
 #include "LadderFilterBase.h"
 #include "Util.h"
 
+#include <string.h>
+
 /*
 Imitates a Moog resonant filter by Runge-Kutte numerical integration of
 a differential equation approximately describing the dynamics of the circuit.
@@ -62,21 +65,107 @@ The differential equations are:
 where k controls the cutoff frequency, r is feedback (<= 4 for stability), and S(x) is a saturation function.
 */
 
-class RKSimulationMoog : public LadderFilterBase
+struct RKSimulationCoeffs
 {
+	void SetCutoff(float sampleRate, float c)
+	{
+		cutoff = c;
+		// Rounded to float, as the original stored it in its float cutoff member
+		k = (float) (2.0 * MOOG_PI * c);
+		oversampleFactor = 1;
+		stepSize = 1.0 / (oversampleFactor * sampleRate);
+	}
 	
-public:
+	void SetResonance(float r)
+	{
+		// 0 to 10
+		resonance = r;
+	}
 	
-	RKSimulationMoog(float sampleRate) : LadderFilterBase(sampleRate)
+	float cutoff;
+	float resonance; // r in the equations above
+	double k; // cutoff in radians per second
+	double stepSize;
+	int oversampleFactor;
+};
+
+struct RKSimulationState
+{
+	void Init()
 	{
 		memset(state, 0, sizeof(state));
-		
 		saturation = 3.0;
 		saturationInv = 1.0 / saturation;
+	}
+	
+	double state[4];
+	double saturation, saturationInv;
+};
+
+inline void moog_rk_derivatives(const RKSimulationCoeffs & c, const RKSimulationState & st, float input, double * dstate, const double * state)
+{
+	const double saturation = st.saturation;
+	const double saturationInv = st.saturationInv;
+	
+	double satstate0 = clip(state[0], saturation, saturationInv);
+	double satstate1 = clip(state[1], saturation, saturationInv);
+	double satstate2 = clip(state[2], saturation, saturationInv);
+	
+	dstate[0] = c.k * (clip(input - c.resonance * state[3], saturation, saturationInv) - satstate0);
+	dstate[1] = c.k * (satstate0 - satstate1);
+	dstate[2] = c.k * (satstate1 - satstate2);
+	dstate[3] = c.k * (satstate2 - clip(state[3], saturation, saturationInv));
+}
+
+inline void moog_rk_step(const RKSimulationCoeffs & c, RKSimulationState & st, float input)
+{
+	int i;
+	double deriv1[4], deriv2[4], deriv3[4], deriv4[4], tempState[4];
+	double * state = st.state;
+	const double stepSize = c.stepSize;
+	
+	moog_rk_derivatives(c, st, input, deriv1, state);
+	
+	for (i = 0; i < 4; i++)
+		tempState[i] = state[i] + 0.5 * stepSize * deriv1[i];
+	
+	moog_rk_derivatives(c, st, input, deriv2, tempState);
+	
+	for (i = 0; i < 4; i++)
+		tempState[i] = state[i] + 0.5 * stepSize * deriv2[i];
+	
+	moog_rk_derivatives(c, st, input, deriv3, tempState);
+	
+	for (i = 0; i < 4; i++)
+		tempState[i] = state[i] + stepSize * deriv3[i];
+	
+	moog_rk_derivatives(c, st, input, deriv4, tempState);
+	
+	for (i = 0; i < 4; i++)
+		state[i] += (1.0 / 6.0) * stepSize * (deriv1[i] + 2.0 * deriv2[i] + 2.0 * deriv3[i] + deriv4[i]);
+}
+
+inline void moog_process(const RKSimulationCoeffs & c, RKSimulationState & st, float * samples, uint32_t n)
+{
+	for (int s = 0; s < n; ++s)
+	{
+		for (int j = 0; j < c.oversampleFactor; j++)
+		{
+			moog_rk_step(c, st, samples[s]);
+		}
 		
-		oversampleFactor = 1;
-		
-		stepSize = 1.0 / (oversampleFactor * sampleRate);
+		samples[s] = st.state[3];
+	}
+}
+
+class RKSimulationMoog : public LadderModel<RKSimulationCoeffs, RKSimulationState>
+{
+	
+public:
+	
+	RKSimulationMoog(float sampleRate) : LadderModel(sampleRate)
+	{
+		state.Init();
 		
 		SetCutoff(1000.f);
 		SetResonance(1.0f);
@@ -88,73 +177,35 @@ public:
 	
 	virtual void Process(float * samples, uint32_t n) override
 	{
-		for (int s = 0; s < n; ++s)
-		{
-			for (int j = 0; j < oversampleFactor; j++)
-			{
-				rungekutteSolver(samples[s], state);
-			}
-			
-			samples[s] = state[3];
-		}
+		moog_process(coeffs.Get(), state, samples, n);
 	}
 	
-	virtual void SetResonance(float r) override
+	virtual bool SetParameter(Parameter p, float value) override
 	{
-		// 0 to 10
-		resonance = r;
+		if (p != SATURATION || !(value > 0.0f)) return false;
+		state.saturation = value;
+		state.saturationInv = 1.0 / state.saturation;
+		return true;
 	}
 	
-	virtual void SetCutoff(float c) override
+	virtual bool GetParameter(Parameter p, float & value) override
 	{
-		cutoff = (2.0 * MOOG_PI * c);
+		if (p != SATURATION) return false;
+		value = state.saturation;
+		return true;
 	}
 	
-private:
-	
-	void calculateDerivatives(float input, double * dstate, double * state)
+	virtual void SetResonance(float r) override
 	{
-		double satstate0 = clip(state[0], saturation, saturationInv);
-		double satstate1 = clip(state[1], saturation, saturationInv);
-		double satstate2 = clip(state[2], saturation, saturationInv);
-		
-		dstate[0] = cutoff * (clip(input - resonance * state[3], saturation, saturationInv) - satstate0);
-		dstate[1] = cutoff * (satstate0 - satstate1);
-		dstate[2] = cutoff * (satstate1 - satstate2);
-		dstate[3] = cutoff * (satstate2 - clip(state[3], saturation, saturationInv));
+		resonance = r;
+		coeffs.Edit().SetResonance(r);
 	}
-
-	void rungekutteSolver(float input, double * state)
+	
+	virtual void SetCutoff(float c) override
 	{
-		int i;
-		double deriv1[4], deriv2[4], deriv3[4], deriv4[4], tempState[4];
-		
-		calculateDerivatives(input, deriv1, state);
-		
-		for (i = 0; i < 4; i++)
-			tempState[i] = state[i] + 0.5 * stepSize * deriv1[i];
-		
-		calculateDerivatives(input, deriv2, tempState);
-		
-		for (i = 0; i < 4; i++)
-			tempState[i] = state[i] + 0.5 * stepSize * deriv2[i];
-		
-		calculateDerivatives(input, deriv3, tempState);
-		
-		for (i = 0; i < 4; i++)
-			tempState[i] = state[i] + stepSize * deriv3[i];
-		
-		calculateDerivatives(input, deriv4, tempState);
-		
-		for (i = 0; i < 4; i++)
-			state[i] += (1.0 / 6.0) * stepSize * (deriv1[i] + 2.0 * deriv2[i] + 2.0 * deriv3[i] + deriv4[i]);
+		cutoff = c;
+		coeffs.Edit().SetCutoff(sampleRate, c);
 	}
-	
-	double state[4];
-	double saturation, saturationInv;
-	int oversampleFactor;
-	double stepSize;
-
 };
 
 #endif
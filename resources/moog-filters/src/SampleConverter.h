@@ -0,0 +1,362 @@
+#pragma once
+
+#ifndef SAMPLE_CONVERTER_H
+#define SAMPLE_CONVERTER_H
+
+#include "Util.h"
+
+#include <stdint.h>
+#include <string.h>
+#include <algorithm>
+#include <vector>
+
+/*
+Conversion between the float samples the filters work on and the integer
+formats audio hardware tends to expose natively. Letting the device open in its
+own format means RtAudio passes buffers straight through instead of running its
+per-sample conversion (and byte swapping) loops on every callback.
+
+Float to integer rounds to nearest and saturates. The SSE2 path converts four
+samples per instruction and gets saturation for free from the packing
+instructions; the scalar loops handle the remainder and other architectures.
+Dither noise is generated four lanes at a time by independent xorshift32
+generators and added in LSB units before rounding: rectangular is +/-0.5 LSB,
+triangular (TPDF) is the sum of two such values. 32-bit output is not
+dithered since a float has fewer significant bits than the target.
+
+Integer formats are interleaved and host-endian. 24-bit samples are packed in
+three bytes, matching RTAUDIO_SINT24.
+*/
+
+enum SampleFormat
+{
+	SAMPLE_FLOAT32,
+	SAMPLE_INT16,
+	SAMPLE_INT24,
+	SAMPLE_INT32
+};
+
+enum DitherType
+{
+	DITHER_NONE,
+	DITHER_RECTANGULAR,
+	DITHER_TRIANGULAR
+};
+
+inline int moog_sample_bytes(SampleFormat format)
+{
+	switch (format)
+	{
+		case SAMPLE_INT16: return 2;
+		case SAMPLE_INT24: return 3;
+		default: return 4;
+	}
+}
+
+// Four independent xorshift32 generators
+class DitherNoise
+{
+public:
+
+	DitherNoise(uint32_t seed = 0x9E3779B9u)
+	{
+		for (int i = 0; i < 4; ++i)
+		{
+			seed = seed * 1664525u + 1013904223u;
+			state[i] = seed | 1u;
+		}
+	}
+
+	// n values in LSB units
+	void Fill(float * noise, size_t n, DitherType type)
+	{
+		const int draws = type == DITHER_TRIANGULAR ? 2 : 1;
+		const float scale = 1.0f / 4294967296.0f;
+
+		size_t i = 0;
+		for (; i + 4 <= n; i += 4)
+		{
+			for (int v = 0; v < 4; ++v) noise[i + v] = 0.0f;
+			for (int d = 0; d < draws; ++d)
+			{
+				for (int v = 0; v < 4; ++v)
+				{
+					noise[i + v] += (float) (int32_t) Next(v) * scale;
+				}
+			}
+		}
+		for (; i < n; ++i)
+		{
+			float v = 0.0f;
+			for (int d = 0; d < draws; ++d) v += (float) (int32_t) Next(0) * scale;
+			noise[i] = v;
+		}
+	}
+
+private:
+
+	inline uint32_t Next(int lane)
+	{
+		uint32_t x = state[lane];
+		x ^= x << 13;
+		x ^= x >> 17;
+		x ^= x << 5;
+		return state[lane] = x;
+	}
+
+	uint32_t state[4];
+};
+
+// Rounds half to even like the SSE conversions
+inline float moog_round_clamp(float x, float lo, float hi)
+{
+	x = x < lo ? lo : (x > hi ? hi : x);
+	return nearbyintf(x);
+}
+
+// n interleaved samples. noise may be null.
+inline void moog_float_to_int16(const float * in, const float * noise, int16_t * out, size_t n)
+{
+	size_t i = 0;
+#ifdef MOOG_SSE2
+	const __m128 scale = _mm_set1_ps(32767.0f);
+	for (; i + 8 <= n; i += 8)
+	{
+		__m128 a = _mm_mul_ps(_mm_loadu_ps(in + i), scale);
+		__m128 b = _mm_mul_ps(_mm_loadu_ps(in + i + 4), scale);
+		if (noise)
+		{
+			a = _mm_add_ps(a, _mm_loadu_ps(noise + i));
+			b = _mm_add_ps(b, _mm_loadu_ps(noise + i + 4));
+		}
+		// Out of range values convert to INT32_MIN, which the pack saturates to -32768,
+		// so clip positive overflow first
+		a = _mm_min_ps(a, _mm_set1_ps(32767.0f));
+		b = _mm_min_ps(b, _mm_set1_ps(32767.0f));
+		_mm_storeu_si128((__m128i *) (out + i), _mm_packs_epi32(_mm_cvtps_epi32(a), _mm_cvtps_epi32(b)));
+	}
+#endif
+	for (; i < n; ++i)
+	{
+		const float x = in[i] * 32767.0f + (noise ? noise[i] : 0.0f);
+		out[i] = (int16_t) moog_round_clamp(x, -32768.0f, 32767.0f);
+	}
+}
+
+inline void moog_float_to_int24(const float * in, const float * noise, uint8_t * out, size_t n)
+{
+	size_t i = 0;
+#ifdef MOOG_SSE2
+	const __m128 scale = _mm_set1_ps(8388607.0f);
+	const __m128 lo = _mm_set1_ps(-8388608.0f);
+	const __m128 hi = _mm_set1_ps(8388607.0f);
+	alignas(16) int32_t lanes[4];
+	for (; i + 4 <= n; i += 4)
+	{
+		__m128 a = _mm_mul_ps(_mm_loadu_ps(in + i), scale);
+		if (noise) a = _mm_add_ps(a, _mm_loadu_ps(noise + i));
+		_mm_store_si128((__m128i *) lanes, _mm_cvtps_epi32(_mm_max_ps(lo, _mm_min_ps(a, hi))));
+
+		// Four 24-bit samples in 12 bytes, written as one 64-bit and one 32-bit store
+		const uint64_t l0 = (uint32_t) lanes[0] & 0xFFFFFF, l1 = (uint32_t) lanes[1] & 0xFFFFFF;
+		const uint64_t l2 = (uint32_t) lanes[2] & 0xFFFFFF, l3 = (uint32_t) lanes[3] & 0xFFFFFF;
+		const uint64_t head = l0 | (l1 << 24) | (l2 << 48);
+		const uint32_t tail = (uint32_t) ((l2 >> 16) | (l3 << 8));
+		memcpy(out + 3 * i, &head, 8);
+		memcpy(out + 3 * i + 8, &tail, 4);
+	}
+#endif
+	for (; i < n; ++i)
+	{
+		const int32_t x = (int32_t) moog_round_clamp(in[i] * 8388607.0f + (noise ? noise[i] : 0.0f), -8388608.0f, 8388607.0f);
+		uint8_t * o = out + 3 * i;
+		o[0] = (uint8_t) x;
+		o[1] = (uint8_t) (x >> 8);
+		o[2] = (uint8_t) (x >> 16);
+	}
+}
+
+inline void moog_float_to_int32(const float * in, int32_t * out, size_t n)
+{
+	// Largest float below 2^31
+	const float hiLimit = 2147483520.0f;
+
+	size_t i = 0;
+#ifdef MOOG_SSE2
+	const __m128 scale = _mm_set1_ps(2147483648.0f);
+	const __m128 lo = _mm_set1_ps(-2147483648.0f);
+	const __m128 hi = _mm_set1_ps(hiLimit);
+	for (; i + 4 <= n; i += 4)
+	{
+		const __m128 a = _mm_mul_ps(_mm_loadu_ps(in + i), scale);
+		_mm_storeu_si128((__m128i *) (out + i), _mm_cvtps_epi32(_mm_max_ps(lo, _mm_min_ps(a, hi))));
+	}
+#endif
+	for (; i < n; ++i)
+	{
+		out[i] = (int32_t) moog_round_clamp(in[i] * 2147483648.0f, -2147483648.0f, hiLimit);
+	}
+}
+
+inline void moog_int16_to_float(const int16_t * in, float * out, size_t n)
+{
+	const float scale = 1.0f / 32768.0f;
+
+	size_t i = 0;
+#ifdef MOOG_SSE2
+	const __m128 s = _mm_set1_ps(scale);
+	for (; i + 8 <= n; i += 8)
+	{
+		const __m128i x = _mm_loadu_si128((const __m128i *) (in + i));
+		// Sign-extend by placing each sample in the high half and shifting down
+		const __m128i a = _mm_srai_epi32(_mm_unpacklo_epi16(_mm_setzero_si128(), x), 16);
+		const __m128i b = _mm_srai_epi32(_mm_unpackhi_epi16(_mm_setzero_si128(), x), 16);
+		_mm_storeu_ps(out + i, _mm_mul_ps(_mm_cvtepi32_ps(a), s));
+		_mm_storeu_ps(out + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(b), s));
+	}
+#endif
+	for (; i < n; ++i) out[i] = in[i] * scale;
+}
+
+inline void moog_int24_to_float(const uint8_t * in, float * out, size_t n)
+{
+	const float scale = 1.0f / 2147483648.0f;
+	for (size_t i = 0; i < n; ++i)
+	{
+		const uint8_t * p = in + 3 * i;
+		const int32_t x = (int32_t) (((uint32_t) p[0] << 8) | ((uint32_t) p[1] << 16) | ((uint32_t) p[2] << 24));
+		out[i] = (float) x * scale;
+	}
+}
+
+inline void moog_int32_to_float(const int32_t * in, float * out, size_t n)
+{
+	const float scale = 1.0f / 2147483648.0f;
+
+	size_t i = 0;
+#ifdef MOOG_SSE2
+	const __m128 s = _mm_set1_ps(scale);
+	for (; i + 4 <= n; i += 4)
+	{
+		_mm_storeu_ps(out + i, _mm_mul_ps(_mm_cvtepi32_ps(_mm_loadu_si128((const __m128i *) (in + i))), s));
+	}
+#endif
+	for (; i < n; ++i) out[i] = (float) in[i] * scale;
+}
+
+// Converts between planar or interleaved float and one interleaved device
+// format. Scratch space is allocated up front for maxFrames; longer calls are
+// split into chunks, so nothing allocates on the audio thread.
+class SampleConverter
+{
+	NO_COPY(SampleConverter);
+
+public:
+
+	SampleConverter(SampleFormat format, int numChannels, uint32_t maxFrames, DitherType dither = DITHER_TRIANGULAR)
+	: format(format), numChannels(numChannels), maxFrames(std::max<uint32_t>(maxFrames, 1)), dither(dither)
+	{
+		interleaved.resize(this->maxFrames * numChannels);
+		noise.resize(this->maxFrames * numChannels);
+	}
+
+	// Interleaved float to the device format
+	void Write(const float * in, void * out, size_t samples)
+	{
+		uint8_t * o = (uint8_t *) out;
+		const int bytes = moog_sample_bytes(format);
+
+		while (samples)
+		{
+			const size_t count = std::min(samples, noise.size());
+			const float * dn = nullptr;
+
+			if (dither != DITHER_NONE && (format == SAMPLE_INT16 || format == SAMPLE_INT24))
+			{
+				ditherNoise.Fill(noise.data(), count, dither);
+				dn = noise.data();
+			}
+
+			switch (format)
+			{
+				case SAMPLE_FLOAT32: memcpy(o, in, count * sizeof(float)); break;
+				case SAMPLE_INT16: moog_float_to_int16(in, dn, (int16_t *) o, count); break;
+				case SAMPLE_INT24: moog_float_to_int24(in, dn, o, count); break;
+				case SAMPLE_INT32: moog_float_to_int32(in, (int32_t *) o, count); break;
+			}
+
+			in += count;
+			o += count * bytes;
+			samples -= count;
+		}
+	}
+
+	// Device format to interleaved float
+	void Read(const void * in, float * out, size_t samples)
+	{
+		switch (format)
+		{
+			case SAMPLE_FLOAT32: memcpy(out, in, samples * sizeof(float)); break;
+			case SAMPLE_INT16: moog_int16_to_float((const int16_t *) in, out, samples); break;
+			case SAMPLE_INT24: moog_int24_to_float((const uint8_t *) in, out, samples); break;
+			case SAMPLE_INT32: moog_int32_to_float((const int32_t *) in, out, samples); break;
+		}
+	}
+
+	// Planar float channels to the interleaved device format. Float output
+	// is interleaved in place, without going through the scratch buffer.
+	void Write(const float * const * channels, void * out, uint32_t frames)
+	{
+		uint8_t * o = (uint8_t *) out;
+		const size_t frameBytes = numChannels * moog_sample_bytes(format);
+		const bool native = format == SAMPLE_FLOAT32;
+
+		for (uint32_t offset = 0; offset < frames; offset += maxFrames)
+		{
+			const uint32_t count = std::min(maxFrames, frames - offset);
+			float * frame = native ? (float *) (o + offset * frameBytes) : interleaved.data();
+			for (int c = 0; c < numChannels; ++c)
+			{
+				const float * src = channels[c] + offset;
+				float * dst = frame + c;
+				for (uint32_t f = 0; f < count; ++f) dst[f * numChannels] = src[f];
+			}
+			if (!native) Write(interleaved.data(), o + offset * frameBytes, count * numChannels);
+		}
+	}
+
+	// Interleaved device format to planar float channels
+	void Read(const void * in, float * const * channels, uint32_t frames)
+	{
+		const uint8_t * i = (const uint8_t *) in;
+		const size_t frameBytes = numChannels * moog_sample_bytes(format);
+
+		for (uint32_t offset = 0; offset < frames; offset += maxFrames)
+		{
+			const uint32_t count = std::min(maxFrames, frames - offset);
+			Read(i + offset * frameBytes, interleaved.data(), count * numChannels);
+			for (int c = 0; c < numChannels; ++c)
+			{
+				const float * src = interleaved.data() + c;
+				float * dst = channels[c] + offset;
+				for (uint32_t f = 0; f < count; ++f) dst[f] = src[f * numChannels];
+			}
+		}
+	}
+
+	SampleFormat GetFormat() const { return format; }
+	int GetNumChannels() const { return numChannels; }
+
+private:
+
+	SampleFormat format;
+	int numChannels;
+	uint32_t maxFrames;
+	DitherType dither;
+	DitherNoise ditherNoise;
+
+	std::vector<float> interleaved;
+	std::vector<float> noise;
+};
+
+#endif
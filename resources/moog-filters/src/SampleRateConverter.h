@@ -0,0 +1,231 @@
+#pragma once
+
+#ifndef SAMPLE_RATE_CONVERTER_H
+#define SAMPLE_RATE_CONVERTER_H
+
+#include "Util.h"
+
+#include <algorithm>
+#include <stdexcept>
+#include <vector>
+#include <string.h>
+
+/*
+Asynchronous sample-rate conversion between the rate the filters are tuned for
+and the rate the device actually runs at, on planar channels.
+
+Every output sample is a windowed-sinc interpolation (Kaiser window) of the
+input around its fractional position. The kernel is tabulated in `phases`
+polyphase rows of `taps` coefficients; the two rows bracketing the fractional
+position are both applied and their results blended linearly, so arbitrary
+and slowly varying ratios work without recomputing coefficients. Each row is
+normalized to unity DC gain. When downsampling the cutoff is lowered to the
+output Nyquist frequency. The dot products run four taps per SSE instruction
+and the coefficient rows are shared by all channels of a frame.
+
+The ratio can be trimmed while running. TrackFill() is a PI controller that
+steers the ratio so the fill level of a downstream ring settles at a target,
+which absorbs the slow drift between two free-running clocks.
+
+Latency is taps / 2 input frames.
+*/
+
+enum ResampleQuality
+{
+	RESAMPLE_FAST, // 8 taps, 64 phases
+	RESAMPLE_MEDIUM, // 16 taps, 128 phases
+	RESAMPLE_HIGH // 32 taps, 256 phases
+};
+
+class SampleRateConverter
+{
+	NO_COPY(SampleRateConverter);
+
+public:
+
+	// maxInputFrames is the largest block passed to Process
+	SampleRateConverter(int numChannels, double inputRate, double outputRate, ResampleQuality quality = RESAMPLE_MEDIUM, size_t maxInputFrames = 4096)
+	: numChannels(numChannels), maxInput(maxInputFrames), nominalStep(inputRate / outputRate)
+	{
+		if (numChannels < 1 || inputRate <= 0.0 || outputRate <= 0.0) throw std::runtime_error("invalid resampler configuration");
+
+		double beta = 0.0, rolloff = 0.0;
+		switch (quality)
+		{
+			case RESAMPLE_FAST: taps = 8; phases = 64; beta = 5.0; rolloff = 0.85; break;
+			case RESAMPLE_MEDIUM: taps = 16; phases = 128; beta = 7.0; rolloff = 0.90; break;
+			default: taps = 32; phases = 256; beta = 9.0; rolloff = 0.94; break;
+		}
+
+		BuildTable(rolloff * std::min(1.0, outputRate / inputRate), beta);
+
+		history.resize(numChannels);
+		for (auto & h : history) h.assign(taps + maxInput, 0.0f);
+
+		Reset();
+	}
+
+	void Reset()
+	{
+		for (auto & h : history) std::fill(h.begin(), h.end(), 0.0f);
+
+		// Primed with taps - 1 frames of silence; the first output lines up with the first input
+		fill = taps - 1;
+		position = taps - 1;
+		adjust = 1.0;
+		integral = 0.0;
+	}
+
+	// Upper bound on the frames one call to Process can return
+	size_t GetMaxOutput(size_t inputFrames) const
+	{
+		return (size_t) (inputFrames / (nominalStep * MIN_ADJUST)) + 2;
+	}
+
+	// Consumes all inputFrames (at most maxInputFrames) and returns the number
+	// of frames written to out, whose channels must hold GetMaxOutput(inputFrames).
+	size_t Process(const float * const * in, size_t inputFrames, float * const * out)
+	{
+		if (inputFrames > maxInput) throw std::runtime_error("resampler input block too long");
+
+		for (int c = 0; c < numChannels; ++c) memcpy(history[c].data() + fill, in[c], inputFrames * sizeof(float));
+		fill += inputFrames;
+
+		const double step = nominalStep * adjust;
+		const int half = taps / 2;
+		size_t produced = 0;
+
+		while ((size_t) position + half < fill)
+		{
+			const size_t n = (size_t) position;
+			const double p = (position - n) * phases;
+			const int row = (int) p;
+			const float blend = (float) (p - row);
+			const float * h0 = table.data() + row * taps;
+			const float * h1 = h0 + taps;
+			const size_t start = n + 1 - half;
+
+			for (int c = 0; c < numChannels; ++c)
+			{
+				const float * x = history[c].data() + start;
+				const float a = Dot(x, h0);
+				const float b = Dot(x, h1);
+				out[c][produced] = a + (b - a) * blend;
+			}
+
+			++produced;
+			position += step;
+		}
+
+		// Keep the frames the next output still needs
+		const size_t discard = std::min(fill, (size_t) position + 1 - half);
+		for (int c = 0; c < numChannels; ++c) memmove(history[c].data(), history[c].data() + discard, (fill - discard) * sizeof(float));
+		fill -= discard;
+		position -= discard;
+
+		return produced;
+	}
+
+	// Trims the conversion ratio, e.g. from a measured clock ratio. Clamped to +/-1%.
+	void SetRatioAdjust(double factor)
+	{
+		const double lo = MIN_ADJUST, hi = MAX_ADJUST;
+		adjust = std::max(lo, std::min(hi, factor));
+	}
+
+	double GetRatioAdjust() const { return adjust; }
+
+	// Feedback from a downstream buffer, once per block: fill and target in
+	// frames. A ring that runs fuller than the target means the consumer is
+	// slower than nominal, so fewer output frames are produced, and vice versa.
+	void TrackFill(double fillFrames, double targetFrames, double blockFrames)
+	{
+		const double error = (fillFrames - targetFrames) / std::max(targetFrames, 1.0);
+		integral = std::max(-0.01, std::min(0.01, integral + error * blockFrames * 1e-6));
+		SetRatioAdjust(1.0 + 1e-3 * error + integral);
+	}
+
+	int GetTaps() const { return taps; }
+	int GetPhases() const { return phases; }
+	size_t GetLatency() const { return taps / 2; }
+
+private:
+
+	static constexpr double MIN_ADJUST = 0.99;
+	static constexpr double MAX_ADJUST = 1.01;
+
+	// Zeroth-order modified Bessel function of the first kind
+	static double BesselI0(double x)
+	{
+		double sum = 1.0, term = 1.0;
+		for (int k = 1; k < 32; ++k)
+		{
+			term *= (x / (2.0 * k)) * (x / (2.0 * k));
+			sum += term;
+		}
+		return sum;
+	}
+
+	// cutoff is relative to the input Nyquist frequency
+	void BuildTable(double cutoff, double beta)
+	{
+		const int half = taps / 2;
+		table.assign((phases + 1) * taps, 0.0f);
+
+		for (int p = 0; p <= phases; ++p)
+		{
+			std::vector<double> row(taps);
+			double sum = 0.0;
+
+			for (int k = 0; k < taps; ++k)
+			{
+				// Distance from the output position to input frame start + k
+				const double d = (double) p / phases + half - 1 - k;
+				const double x = cutoff * d;
+				const double sinc = fabs(x) < 1e-9 ? 1.0 : sin(MOOG_PI * x) / (MOOG_PI * x);
+				const double r = d / half;
+				const double window = fabs(r) >= 1.0 ? 0.0 : BesselI0(beta * sqrt(1.0 - r * r)) / BesselI0(beta);
+				row[k] = sinc * window;
+				sum += row[k];
+			}
+
+			for (int k = 0; k < taps; ++k) table[p * taps + k] = (float) (row[k] / sum);
+		}
+	}
+
+	inline float Dot(const float * x, const float * h) const
+	{
+#if defined(MOOG_SSE2)
+		__m128 a = _mm_setzero_ps();
+		__m128 b = _mm_setzero_ps();
+		for (int k = 0; k < taps; k += 8)
+		{
+			a = _mm_add_ps(a, _mm_mul_ps(_mm_loadu_ps(x + k), _mm_loadu_ps(h + k)));
+			b = _mm_add_ps(b, _mm_mul_ps(_mm_loadu_ps(x + k + 4), _mm_loadu_ps(h + k + 4)));
+		}
+		a = _mm_add_ps(a, b);
+		a = _mm_add_ps(a, _mm_movehl_ps(a, a));
+		a = _mm_add_ss(a, _mm_shuffle_ps(a, a, 1));
+		return _mm_cvtss_f32(a);
+#else
+		float acc = 0.0f;
+		for (int k = 0; k < taps; ++k) acc += x[k] * h[k];
+		return acc;
+#endif
+	}
+
+	int numChannels;
+	int taps = 0;
+	int phases = 0;
+	size_t maxInput;
+	double nominalStep; // input frames per output frame
+	double adjust = 1.0;
+	double integral = 0.0;
+
+	std::vector<float> table; // phases + 1 rows of taps
+	std::vector<std::vector<float>> history; // per channel
+	size_t fill = 0;
+	double position = 0.0; // of the next output, in frames from history[c][0]
+};
+
+#endif
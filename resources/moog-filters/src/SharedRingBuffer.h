@@ -0,0 +1,340 @@
+#pragma once
+
+#ifndef SHARED_RING_BUFFER_H
+#define SHARED_RING_BUFFER_H
+
+#include "Util.h"
+
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <stdint.h>
+#include <string.h>
+
+#if !defined(_WIN32)
+	#include <fcntl.h>
+	#include <sys/mman.h>
+	#include <sys/stat.h>
+	#include <unistd.h>
+#endif
+
+#if defined(__linux__)
+	#include <linux/futex.h>
+	#include <sys/syscall.h>
+	#include <time.h>
+#endif
+
+/*
+Single-producer/single-consumer ring in POSIX shared memory, so a sandboxed
+render process can feed the process that owns the audio device without
+serializing buffers through a pipe. It keeps the interface and acquire/release
+protocol of RingBufferT and the free-running, masked indices of
+MaskedRingBufferT.
+
+The shared object holds a one-page header (indices on separate cache lines,
+capacity and wakeup words) followed by the sample data. The data pages are
+mapped a second time right after the first mapping, so reads and writes are
+always one contiguous memcpy.
+
+The owner creates the ring, either by name (shm_open) or anonymously (memfd on
+Linux, to be handed to the other process as a file descriptor), and the peer
+opens or attaches to it. Either side may be producer or consumer.
+
+Blocking waits are for the non-real-time side only. On Linux they sleep on a
+futex in the shared header, and the other side issues a wake only when someone
+is actually waiting, so the audio callback normally makes no syscalls. Other
+POSIX systems fall back to short sleeps. Not available on Windows.
+*/
+
+template <typename T>
+class SharedRingBufferT
+{
+	static_assert(std::is_trivially_copyable<T>::value, "Ring elements are copied with memcpy");
+	static_assert(ATOMIC_LLONG_LOCK_FREE == 2 && ATOMIC_INT_LOCK_FREE == 2, "Shared atomics must be lock-free");
+
+	NO_COPY(SharedRingBufferT);
+
+	static const uint32_t MAGIC = 0x4D4F4F47; // "MOOG"
+
+	struct Header
+	{
+		uint32_t magic;
+		uint32_t elementSize;
+		uint64_t capacity;
+		char padding0[48];
+		std::atomic<uint64_t> writeIndex;
+		std::atomic<uint32_t> writeSeq; // futex word, bumped on every write
+		std::atomic<uint32_t> dataWaiters;
+		char padding1[48];
+		std::atomic<uint64_t> readIndex;
+		std::atomic<uint32_t> readSeq; // futex word, bumped on every read
+		std::atomic<uint32_t> spaceWaiters;
+		char padding2[48];
+		std::atomic<uint32_t> producerActive;
+	};
+
+public:
+
+	SharedRingBufferT() {}
+	~SharedRingBufferT() { close(); }
+
+	// Creates a ring holding at least count elements. With a name it is
+	// created through shm_open (and unlinked again by close()); without one it
+	// is an anonymous memfd whose descriptor is available from getFd().
+	// A name left behind by an owner that crashed makes this fail until it is
+	// removed with shm_unlink().
+	bool create(size_t count, const char * name = nullptr)
+	{
+#if defined(_WIN32)
+		return false;
+#else
+		close();
+
+		const size_t page = (size_t) sysconf(_SC_PAGESIZE);
+		size_t slots = 1;
+		while (slots < count || (slots * sizeof(T)) % page) slots <<= 1;
+
+		int descriptor = -1;
+		if (name)
+		{
+			descriptor = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+			if (descriptor >= 0) shmName = name;
+		}
+#if defined(__linux__)
+		else
+		{
+			descriptor = memfd_create("moog-shared-ring", 0);
+		}
+#endif
+		if (descriptor < 0) return false;
+
+		if (ftruncate(descriptor, page + slots * sizeof(T)) != 0 || !map(descriptor, slots))
+		{
+			::close(descriptor);
+			close();
+			return false;
+		}
+
+		memset((void *) header, 0, sizeof(Header));
+		header->elementSize = sizeof(T);
+		header->capacity = slots;
+		header->writeIndex.store(0);
+		header->readIndex.store(0);
+		header->magic = MAGIC;
+
+		fd = descriptor;
+		return true;
+#endif
+	}
+
+	// Attaches to a ring created by name in another process
+	bool open(const char * name)
+	{
+#if defined(_WIN32)
+		return false;
+#else
+		const int descriptor = shm_open(name, O_RDWR, 0600);
+		if (descriptor < 0) return false;
+		if (!attach(descriptor))
+		{
+			::close(descriptor);
+			return false;
+		}
+		return true;
+#endif
+	}
+
+	// Attaches to a ring through a descriptor received from its owner. Takes
+	// ownership of the descriptor on success.
+	bool attach(int descriptor)
+	{
+#if defined(_WIN32)
+		return false;
+#else
+		close();
+
+		const size_t page = (size_t) sysconf(_SC_PAGESIZE);
+		struct stat st;
+		if (fstat(descriptor, &st) != 0 || (size_t) st.st_size <= page) return false;
+
+		const size_t slots = ((size_t) st.st_size - page) / sizeof(T);
+		if (!map(descriptor, slots)) return false;
+
+		if (header->magic != MAGIC || header->elementSize != sizeof(T) || header->capacity != slots)
+		{
+			close();
+			return false;
+		}
+
+		fd = descriptor;
+		return true;
+#endif
+	}
+
+	void close()
+	{
+#if !defined(_WIN32)
+		if (base) munmap(base, mappedBytes);
+		if (fd >= 0) ::close(fd);
+		if (!shmName.empty()) shm_unlink(shmName.c_str());
+#endif
+		base = nullptr;
+		header = nullptr;
+		data = nullptr;
+		capacity = 0;
+		mask = 0;
+		mappedBytes = 0;
+		fd = -1;
+		shmName.clear();
+	}
+
+	bool isOpen() const { return header != nullptr; }
+	int getFd() const { return fd; }
+	size_t getSize() const { return capacity; }
+
+	// Only safe to call from the write thread
+	size_t getAvailableWrite() const
+	{
+		return capacity - (header->writeIndex.load(std::memory_order_relaxed) - header->readIndex.load(std::memory_order_acquire));
+	}
+
+	// Only safe to call from the read thread
+	size_t getAvailableRead() const
+	{
+		return header->writeIndex.load(std::memory_order_acquire) - header->readIndex.load(std::memory_order_relaxed);
+	}
+
+	// Writes all count elements or none. Only safe to call from the write thread.
+	bool write(const T * array, size_t count)
+	{
+		const uint64_t w = header->writeIndex.load(std::memory_order_relaxed);
+		const uint64_t r = header->readIndex.load(std::memory_order_acquire);
+
+		if (count > capacity - (w - r)) return false;
+
+		memcpy(data + (w & mask), array, count * sizeof(T));
+		header->writeIndex.store(w + count, std::memory_order_release);
+
+		header->writeSeq.fetch_add(1, std::memory_order_release);
+		if (header->dataWaiters.load(std::memory_order_acquire)) wake(header->writeSeq);
+		return true;
+	}
+
+	// Reads all count elements or none. Only safe to call from the read thread.
+	bool read(T * array, size_t count)
+	{
+		const uint64_t w = header->writeIndex.load(std::memory_order_acquire);
+		const uint64_t r = header->readIndex.load(std::memory_order_relaxed);
+
+		if (count > w - r) return false;
+
+		memcpy(array, data + (r & mask), count * sizeof(T));
+		header->readIndex.store(r + count, std::memory_order_release);
+
+		header->readSeq.fetch_add(1, std::memory_order_release);
+		if (header->spaceWaiters.load(std::memory_order_acquire)) wake(header->readSeq);
+		return true;
+	}
+
+	// Blocks the write thread until count elements fit or the timeout expires
+	bool waitForSpace(size_t count, double timeoutSeconds)
+	{
+		return waitUntil(header->readSeq, header->spaceWaiters, timeoutSeconds, [&]() { return getAvailableWrite() >= count; });
+	}
+
+	// Blocks the read thread until count elements are available or the timeout expires
+	bool waitForData(size_t count, double timeoutSeconds)
+	{
+		return waitUntil(header->writeSeq, header->dataWaiters, timeoutSeconds, [&]() { return getAvailableRead() >= count; });
+	}
+
+	// Lets the consumer tell a stalled producer apart from one that has finished
+	void setProducerActive(bool active) { header->producerActive.store(active ? 1 : 0, std::memory_order_release); }
+	bool isProducerActive() const { return header->producerActive.load(std::memory_order_acquire) != 0; }
+
+private:
+
+	bool map(int descriptor, size_t count)
+	{
+#if defined(_WIN32)
+		return false;
+#else
+		const size_t page = (size_t) sysconf(_SC_PAGESIZE);
+		const size_t dataBytes = count * sizeof(T);
+		const size_t total = page + 2 * dataBytes;
+
+		// Header and data, then the data pages again straight after them
+		uint8_t * region = (uint8_t *) mmap(nullptr, total, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (region == MAP_FAILED) return false;
+
+		bool ok = mmap(region, page + dataBytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, descriptor, 0) != MAP_FAILED;
+		ok = ok && mmap(region + page + dataBytes, dataBytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, descriptor, (off_t) page) != MAP_FAILED;
+		if (!ok)
+		{
+			munmap(region, total);
+			return false;
+		}
+
+		base = region;
+		mappedBytes = total;
+		header = (Header *) region;
+		data = (T *) (region + page);
+		capacity = count;
+		mask = count - 1;
+		return true;
+#endif
+	}
+
+	static void wake(std::atomic<uint32_t> & word)
+	{
+#if defined(__linux__)
+		syscall(SYS_futex, (uint32_t *) &word, FUTEX_WAKE, INT32_MAX, nullptr, nullptr, 0);
+#endif
+	}
+
+	template <typename Ready>
+	static bool waitUntil(std::atomic<uint32_t> & word, std::atomic<uint32_t> & waiters, double timeoutSeconds, Ready ready)
+	{
+		const auto deadline = std::chrono::steady_clock::now() + std::chrono::duration<double>(timeoutSeconds);
+
+		while (!ready())
+		{
+			const auto now = std::chrono::steady_clock::now();
+			if (now >= deadline) return false;
+
+#if defined(__linux__)
+			// Announce the waiter before re-checking, so a wake between the
+			// check and the futex call is not lost: the sequence word changes
+			// and FUTEX_WAIT returns immediately.
+			const uint32_t seq = word.load(std::memory_order_acquire);
+			waiters.fetch_add(1, std::memory_order_acq_rel);
+			if (!ready())
+			{
+				const auto remaining = std::chrono::duration_cast<std::chrono::nanoseconds>(deadline - now).count();
+				struct timespec timeout = { (time_t) (remaining / 1000000000), (long) (remaining % 1000000000) };
+				syscall(SYS_futex, (uint32_t *) &word, FUTEX_WAIT, seq, &timeout, nullptr, 0);
+			}
+			waiters.fetch_sub(1, std::memory_order_acq_rel);
+#else
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+#endif
+		}
+
+		return true;
+	}
+
+	uint8_t * base = nullptr;
+	size_t mappedBytes = 0;
+	Header * header = nullptr;
+	T * data = nullptr;
+	size_t capacity = 0;
+	size_t mask = 0;
+	int fd = -1;
+	std::string shmName;
+};
+
+typedef SharedRingBufferT<float> SharedRingBuffer;
+
+#endif
@@ -11,7 +11,11 @@
 #ifndef SIMPLIFIED_LADDER_H
 #define SIMPLIFIED_LADDER_H
 
+#include "CoefficientCache.h"
 #include "LadderFilterBase.h"
+#include "Oversampler.h"
+
+#include <string.h>
 
 /*
 The simplified nonlinear Moog filter is based on the full Huovilainen model,
@@ -29,21 +33,123 @@ http://music.columbia.edu/pipermail/music-dsp/2005-February/062778.html
 http://www.synthmaker.co.uk/dokuwiki/doku.php?id=tutorials:oversampling
 */
 
-class SimplifiedMoog : public LadderFilterBase
+struct SimplifiedCoeffs
 {
-public:
+	void SetCutoff(float sampleRate, float c)
+	{
+		cutoff = c;
+		
+		// Doublesampled
+		float fs2 = sampleRate * 2;
+		
+		// Normalized cutoff [0, 1] in radians: ((2*pi) * cutoff / samplerate)
+		g = (2 * MOOG_PI) * cutoff / fs2; // feedback coefficient at fs*2 because of doublesampling
+		g *= MOOG_PI / 1.3; // correction factor that allows _cutoff to be supplied Hertz
+		
+		// FIR part with gain g
+		h = g / 1.3;
+		h0 = g * 0.3 / 1.3;
+		decay = 1.0 - g;
+	}
+	
+	void SetResonance(float r)
+	{
+		resonance = r;
+		feedback = 4.0 * resonance;
+	}
 	
-	SimplifiedMoog(float sampleRate) : LadderFilterBase(sampleRate)
+	float cutoff;
+	float resonance;
+	double h;
+	double h0;
+	double g;
+	double decay;
+	double feedback;
+};
+
+// The resampler history is part of the state, which therefore has a
+// constructor but still holds no pointers
+struct SimplifiedState
+{
+	void Init()
 	{
 		// To keep the overall level approximately constant, comp should be set
 		// to 0.5 resulting in a 6 dB passband gain decrease at the maximum resonance
 		// (compared to a 12 dB decrease in the original Moog model
 		gainCompensation = 0.5;
 		
+		output = 0.0;
 		memset(stage, 0, sizeof(stage));
-		memset(stageZ1, 0, sizeof(stageZ1));
 		memset(stageTanh, 0, sizeof(stageTanh));
-		
+		oversampler.Reset();
+	}
+	
+	double output;
+	
+	double stage[4];
+	double stageTanh[4];
+	
+	float gainCompensation;
+
+	Oversampler<2> oversampler;
+};
+
+// This system is nonlinear so we are probably going to create a signal with components that exceed nyquist.
+// To prevent aliasing distortion the ladder runs at twice the sample rate: the input is interpolated and the
+// output decimated with half-band filters (see Oversampler.h).
+// stageTanh[k] always holds tanh(stage[k]) from the previous step, so each step costs five tanh.
+inline void moog_process(const SimplifiedCoeffs & c, SimplifiedState & st, float * samples, uint32_t n)
+{
+	const double feedback = c.feedback;
+	const double decay = c.decay;
+	const double h = c.h;
+	const double h0 = c.h0;
+	const double gainCompensation = st.gainCompensation;
+
+	double s0 = st.stage[0], s1 = st.stage[1], s2 = st.stage[2], s3 = st.stage[3];
+	double t0 = st.stageTanh[0], t1 = st.stageTanh[1], t2 = st.stageTanh[2], t3 = st.stageTanh[3];
+	double y = st.output;
+
+	for (int s = 0; s < n; ++s)
+	{
+		float input[2];
+		float result[2];
+
+		st.oversampler.Upsample(&samples[s], input);
+
+		for (int j = 0; j < 2; ++j)
+		{
+			const double x = input[j];
+
+			s0 = h * tanh(x - feedback * (y - gainCompensation * x)) + h0 * s0 + decay * t0;
+			t0 = tanh(s0);
+			s1 = h * s1 + h0 * t0 + decay * t1;
+			t1 = tanh(s1);
+			s2 = h * s2 + h0 * t1 + decay * t2;
+			t2 = tanh(s2);
+			s3 = h * s3 + h0 * t2 + decay * t3;
+			t3 = tanh(s3);
+
+			y = s3;
+			SNAP_TO_ZERO(y);
+			result[j] = y;
+		}
+
+		st.oversampler.Downsample(result, &samples[s]);
+	}
+
+	st.stage[0] = s0; st.stage[1] = s1; st.stage[2] = s2; st.stage[3] = s3;
+	st.stageTanh[0] = t0; st.stageTanh[1] = t1; st.stageTanh[2] = t2; st.stageTanh[3] = t3;
+	st.output = y;
+}
+
+class SimplifiedMoog : public LadderModel<SimplifiedCoeffs, SimplifiedState>
+{
+public:
+	
+	SimplifiedMoog(float sampleRate) : LadderModel(sampleRate)
+	{
+		state.Init();
 		SetCutoff(1000.0f);
 		SetResonance(0.10f);
 	}
@@ -53,76 +159,152 @@ public:
 		
 	}
 	
-	// This system is nonlinear so we are probably going to create a signal with components that exceed nyquist.
-	// To prevent aliasing distortion, we need to oversample this processing chunk. Where do these extra samples
-	// come from? Todo! We can use polynomial interpolation to generate the extra samples, but this is expensive.
-	// The cheap solution is to zero-stuff the incoming sample buffer.
-	// With resampling, numSamples should be 2x the frame size of the existing sample rate.
-	// The output of this filter needs to be run through a decimator to return to the original samplerate.
 	virtual void Process(float * samples, uint32_t n) override
 	{
-		// Processing still happens at sample rate...
+		moog_process(coeffs.Get(), state, samples, n);
+	}
+	
+	virtual bool SetParameter(Parameter p, float value) override
+	{
+		if (p != GAIN_COMPENSATION) return false;
+		state.gainCompensation = value;
+		return true;
+	}
+	
+	virtual bool GetParameter(Parameter p, float & value) override
+	{
+		if (p != GAIN_COMPENSATION) return false;
+		value = state.gainCompensation;
+		return true;
+	}
+	
+	virtual void SetResonance(float r) override
+	{
+		resonance = r;
+		coeffs.Edit().SetResonance(r);
+	}
+	
+	virtual void SetCutoff(float c) override
+	{
+		cutoff = c;
+		coeffs.Edit().SetCutoff(sampleRate, c);
+	}
+};
+
+/*
+Runs several SimplifiedMoog voices side by side at twice the sample rate. Every
+line of the ladder is evaluated for all lanes at once, and the half-band
+resamplers are shared across lanes. tanh is the rational fast_tanh clamped to
++/-1, which the compiler can vectorize across voices, so the bank follows
+SimplifiedMoog closely but not exactly. Samples are interleaved by voice:
+samples[frame * Voices + voice].
+*/
+
+template <int Voices>
+class SimplifiedMoogBank
+{
+	NO_COPY(SimplifiedMoogBank);
+
+public:
+
+	SimplifiedMoogBank(float sampleRate) : sampleRate(sampleRate)
+	{
+		memset(output, 0, sizeof(output));
+		memset(stage, 0, sizeof(stage));
+		memset(stageTanh, 0, sizeof(stageTanh));
+
+		for (int v = 0; v < Voices; ++v)
+		{
+			gainCompensation[v] = 0.5;
+			SetCutoff(v, 1000.0f);
+			SetResonance(v, 0.10f);
+		}
+	}
+
+	void Process(float * samples, uint32_t n)
+	{
 		for (int s = 0; s < n; ++s)
 		{
-			for (int stageIdx = 0; stageIdx < 4; ++stageIdx)
+			float * frame = samples + s * Voices;
+			float input[2 * Voices];
+			float result[2 * Voices];
+
+			oversampler.Upsample(frame, input);
+
+			for (int j = 0; j < 2; ++j)
 			{
-				if (stageIdx)
+				const float * x = input + j * Voices;
+
+				for (int v = 0; v < Voices; ++v)
+				{
+					stage[0][v] = h[v] * Tanh(x[v] - feedback[v] * (output[v] - gainCompensation[v] * x[v])) + h0[v] * stage[0][v] + decay[v] * stageTanh[0][v];
+					stageTanh[0][v] = Tanh(stage[0][v]);
+				}
+
+				for (int k = 1; k < 4; ++k)
 				{
-					input = stage[stageIdx-1];
-					stageTanh[stageIdx-1] = tanh(input);
-					stage[stageIdx] = (h * stageZ1[stageIdx] + h0 * stageTanh[stageIdx-1]) + (1.0 - g) * (stageIdx != 3 ? stageTanh[stageIdx] : tanh(stageZ1[stageIdx]));
+					for (int v = 0; v < Voices; ++v)
+					{
+						stage[k][v] = h[v] * stage[k][v] + h0[v] * stageTanh[k-1][v] + decay[v] * stageTanh[k][v];
+						stageTanh[k][v] = Tanh(stage[k][v]);
+					}
 				}
-				else
+
+				for (int v = 0; v < Voices; ++v)
 				{
-					input = samples[s] - ((4.0 * resonance) * (output - gainCompensation * samples[s]));
-					stage[stageIdx] = (h * tanh(input) + h0 * stageZ1[stageIdx]) + (1.0 - g) * stageTanh[stageIdx];
+					output[v] = stage[3][v];
+					SNAP_TO_ZERO(output[v]);
+					result[j * Voices + v] = output[v];
 				}
-				
-				stageZ1[stageIdx] = stage[stageIdx];
 			}
-			
-			output = stage[3];
-			SNAP_TO_ZERO(output);
-			samples[s] = output;
+
+			oversampler.Downsample(result, frame);
 		}
 	}
-	
-	virtual void SetResonance(float r) override
+
+	void SetResonance(int voice, float r)
 	{
-		resonance = r;
+		resonance[voice] = r;
+		feedback[voice] = 4.0 * r;
 	}
-	
-	virtual void SetCutoff(float c) override
+
+	void SetCutoff(int voice, float c)
 	{
-		cutoff = c;
-		
-		// Not being oversampled at the moment... * 2 when functional
-		float fs2 = sampleRate;
-		
-		// Normalized cutoff [0, 1] in radians: ((2*pi) * cutoff / samplerate)
-		g = (2 * MOOG_PI) * cutoff / fs2; // feedback coefficient at fs*2 because of doublesampling
-		g *= MOOG_PI / 1.3; // correction factor that allows _cutoff to be supplied Hertz
-		
-		// FIR part with gain g
-		h = g / 1.3;
-		h0 = g * 0.3 / 1.3;
+		cutoff[voice] = c;
+		g[voice] = (2 * MOOG_PI) * c / (sampleRate * 2) * (MOOG_PI / 1.3);
+		h[voice] = g[voice] / 1.3;
+		h0[voice] = g[voice] * 0.3 / 1.3;
+		decay[voice] = 1.0 - g[voice];
 	}
-	
+
+	float GetResonance(int voice) const { return resonance[voice]; }
+	float GetCutoff(int voice) const { return cutoff[voice]; }
+
 private:
-	
-	double output;
-	double lastStage;
-	
-	double stage[4];
-	double stageZ1[4];
-	double stageTanh[3];
-	
-	double input;
-	double h;
-	double h0;
-	double g;
-	
-	float gainCompensation;
+
+	// fast_tanh reaches +/-1 at +/-3 and turns back beyond it
+	static inline double Tanh(double x)
+	{
+		x = x < -3.0 ? -3.0 : (x > 3.0 ? 3.0 : x);
+		return fast_tanh(x);
+	}
+
+	alignas(32) double stage[4][Voices];
+	alignas(32) double stageTanh[4][Voices];
+	alignas(32) double output[Voices];
+
+	alignas(32) double h[Voices];
+	alignas(32) double h0[Voices];
+	alignas(32) double g[Voices];
+	alignas(32) double decay[Voices];
+	alignas(32) double feedback[Voices];
+	alignas(32) double gainCompensation[Voices];
+
+	float cutoff[Voices];
+	float resonance[Voices];
+	float sampleRate;
+
+	Oversampler<2, Voices> oversampler;
 };
 
 #endif
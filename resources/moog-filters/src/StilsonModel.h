@@ -10,8 +10,11 @@
 #ifndef STILSON_LADDER_H
 #define STILSON_LADDER_H
 
+#include "CoefficientCache.h"
 #include "LadderFilterBase.h"
 
+#include <string.h>
+
 /*
 A digital model of the classic Moog filter was presented first by Stilson and
 Smith. This model uses a cascade of one-pole IIR filters in series with a global
@@ -53,52 +56,28 @@ static float S_STILSON_GAINTABLE[199] =
 	0.264252, 0.262909, 0.261566, 0.260223, 0.258911, 0.257599, 0.256317, 0.255035, 0.25375
 };
 
-class StilsonMoog : public LadderFilterBase
+struct StilsonCoeffs
 {
-public:
-	
-	StilsonMoog(float sampleRate) : LadderFilterBase(sampleRate)
-	{
-		memset(state, 0, sizeof(state));
-		SetCutoff(1000.0f);
-		SetResonance(0.10f);
-	}
-	
-	virtual ~StilsonMoog()
+	void SetCutoff(float sampleRate, float c)
 	{
+		cutoff = c;
 		
-	}
-	
-	virtual void Process(float * samples, uint32_t n) override
-	{
-		float localState;
+		// Normalized cutoff between [0, 1]
+		double fc = (cutoff) / sampleRate;
+		double x2 = fc * fc;
+		double x3 = fc * fc * fc;
 		
-		for (int s = 0; s < n; ++s)
-		{
-			// Scale by arbitrary value on account of our saturation function
-			const float input = samples[s] * 0.65f;
-			
-			// Negative Feedback
-			output = 0.25 * (input - output);
-			
-			for (int pole = 0; pole < 4; ++pole)
-			{
-				localState = state[pole];
-				output = moog_saturate(output + p * (output - localState));
-				state[pole] = output;
-				output = moog_saturate(output + localState);
-			}
-			
-			SNAP_TO_ZERO(output);
-			samples[s] = output;
-			output *= Q; // Scale stateful output by Q
-		}
+		// Frequency & amplitude correction (Cubic Fit)
+		p = -0.69346 * x3 - 0.59515 * x2 + 3.2937 * fc - 1.0072;
+		
+		SetResonance(resonance);
 	}
 	
-	virtual void SetResonance(float r) override
+	// resonance keeps the value asked for; the gain uses it clamped to 1
+	void SetResonance(float r)
 	{
-		r = moog_min(r, 1);
 		resonance = r;
+		r = moog_min(r, 1);
 		
 		double ix;
 		double ixfrac;
@@ -111,27 +90,94 @@ public:
 		Q = r * moog_lerp(ixfrac, S_STILSON_GAINTABLE[ixint + 99], S_STILSON_GAINTABLE[ixint + 100]);
 	}
 	
-	virtual void SetCutoff(float c) override
+	float cutoff;
+	float resonance;
+	double p;
+	double Q;
+};
+
+struct StilsonState
+{
+	void Init()
 	{
-		cutoff = c;
+		memset(state, 0, sizeof(state));
+		output = 0.0;
+	}
+	
+	double state[4];
+	double output;
+};
+
+inline void moog_process(const StilsonCoeffs & c, StilsonState & st, float * samples, uint32_t n)
+{
+	const double p = c.p;
+	const double Q = c.Q;
+	double output = st.output;
+	float localState;
+	
+	for (int s = 0; s < n; ++s)
+	{
+		// Scale by arbitrary value on account of our saturation function
+		const float input = samples[s] * 0.65f;
 		
-		// Normalized cutoff between [0, 1]
-		double fc = (cutoff) / sampleRate;
-		double x2 = fc * fc;
-		double x3 = fc * fc * fc;
+		// Negative Feedback
+		output = 0.25 * (input - output);
 		
-		// Frequency & amplitude correction (Cubic Fit)
-		p = -0.69346 * x3 - 0.59515 * x2 + 3.2937 * fc - 1.0072;
+		for (int pole = 0; pole < 4; ++pole)
+		{
+			localState = st.state[pole];
+			output = moog_saturate(output + p * (output - localState));
+			st.state[pole] = output;
+			output = moog_saturate(output + localState);
+		}
 		
-		SetResonance(resonance);
+		SNAP_TO_ZERO(output);
+		samples[s] = output;
+		output *= Q; // Scale stateful output by Q
 	}
 	
-private:
+	st.output = output;
+}
+
+class StilsonMoog : public LadderModel<StilsonCoeffs, StilsonState>
+{
+public:
 	
-	double p;
-	double Q; 
-	double state[4];
-	double output; 
+	StilsonMoog(float sampleRate) : LadderModel(sampleRate)
+	{
+		state.Init();
+		SetCutoff(1000.0f);
+		SetResonance(0.10f);
+	}
+	
+	virtual ~StilsonMoog()
+	{
+		
+	}
+	
+	virtual void Process(float * samples, uint32_t n) override
+	{
+		moog_process(coeffs.Get(), state, samples, n);
+	}
+	
+	virtual void SetResonance(float r) override
+	{
+		resonance = moog_min(r, 1);
+		coeffs.Edit().SetResonance(r);
+	}
+	
+	virtual void SetCutoff(float c) override
+	{
+		cutoff = c;
+		coeffs.Edit().SetCutoff(sampleRate, c);
+	}
+	
+	// Reports the resonance clamped, like SetResonance
+	virtual void SetCoefficients(const std::shared_ptr<const Coeffs> & c) override
+	{
+		LadderModel::SetCoefficients(c);
+		resonance = moog_min(resonance, 1);
+	}
 }; 
 
 #endif